@@ -1,5 +1,17 @@
 #include <benchmark/benchmark.h>
 #include "../src/include/image_processing.h"
+#include "../src/include/resample.h"
+#include "../src/include/convolution.h"
+#include "../src/include/non_local_means.h"
+#include "../src/include/kernel_decomposition.h"
+#include "../src/include/iterated_kernel.h"
+#include "../src/include/flat_tiles.h"
+#include "../src/include/executor.h"
+#include "../src/include/processing_context.h"
+#include "../src/include/numa.h"
+#include "../src/include/batch_processor.h"
+#include "../src/include/pipeline.h"
+#include "../src/include/stb_image_write.h"
 
 static const char *inputFile = "./4k_wallpaper.jpg";
 static const char *outputFile = "./lena_modified.png";
@@ -14,6 +26,7 @@ static void BM_Sequential(benchmark::State &state) {
     Image outputImage = applyKernelSeq(img, kernel);
   }
 }
+#ifdef OPENMP
 static void BM_OpenMP(benchmark::State &state) {
   // Perform setup here
   auto nthreads = state.range(0);
@@ -26,9 +39,388 @@ static void BM_OpenMP(benchmark::State &state) {
     Image outputImage = applyKernelOpenMp(img, kernel, nthreads);
   }
 }
+static void BM_ResizeThenBlur(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  auto kernel = Kernels::Filter::Gaussian();
+  for (auto _ : state) {
+    Image small = resize(img, img.width / 2, img.height / 2,
+                         ResampleFilter::Lanczos3, nthreads);
+    small.padReplication(kernel.size() / 2);
+    Image outputImage = applyKernelOpenMp(small, kernel, nthreads);
+  }
+}
+#endif
+static void BM_ResizeAndBlurFused(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  for (auto _ : state) {
+    Image outputImage = resizeAndBlur(img, img.width / 2, img.height / 2,
+                                      ResampleFilter::Lanczos3, 0.85f,
+                                      nthreads);
+  }
+}
+static void BM_NonLocalMeans(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  NonLocalMeansParams params;
+  for (auto _ : state) {
+    Image outputImage = nonLocalMeans(img, params, nthreads);
+  }
+}
+template <ConvolutionBackend Backend>
+static void BM_Convolve3x3(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::HighPass3x3];
+  img.padReplication(kernel.size() / 2);
+  ConvolutionOptions options;
+  options.backend = Backend;
+  for (auto _ : state) {
+    Image outputImage = convolve(img, kernel, nthreads, options);
+  }
+}
+template <ConvolutionBackend Backend>
+static void BM_Convolve5x5(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  img.padReplication(kernel.size() / 2);
+  ConvolutionOptions options;
+  options.backend = Backend;
+  for (auto _ : state) {
+    Image outputImage = convolve(img, kernel, nthreads, options);
+  }
+}
+template <ColumnPass Pass>
+static void BM_LowRankColumnPass8K(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image source = Image::load(inputFile);
+  Image img = resize(source, source.width * 2, source.height * 2,
+                     ResampleFilter::Bilinear, nthreads);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  img.padReplication(kernel.size() / 2);
+  KernelDecomposition decomposition = KernelDecomposition::analyze(kernel);
+  int rank = decomposition.rankFor(1e-4f);
+  for (auto _ : state) {
+    Image outputImage =
+        applyKernelLowRank(img, decomposition, rank, nthreads, Pass);
+  }
+}
+static void BM_RepeatedPasses8(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  SparseKernel kernel = SparseKernel::compile(kernels[Filter::LowPass3x3]);
+  img.padReplication(kernel.size / 2);
+  for (auto _ : state) {
+    Image outputImage = applyKernelSparse(img, kernel, nthreads);
+    for (int i = 1; i < 8; i++) {
+      outputImage = applyKernelSparse(outputImage, kernel, nthreads);
+    }
+  }
+}
+static void BM_Iterated8(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  SparseKernel kernel = SparseKernel::compile(kernels[Filter::LowPass3x3]);
+  img.padReplication(kernel.size / 2);
+  for (auto _ : state) {
+    Image outputImage = applyKernelIterated(img, kernel, 8, nthreads);
+  }
+}
+// The wallpaper in one corner of a uniform canvas four times its size,
+// like a scan with a large background
+static Image mostlyFlatCanvas() {
+  Image photo = Image::load(inputFile);
+  const int width = photo.width * 2;
+  const int height = photo.height * 2;
+  const int channels = photo.channels;
+  unsigned char *canvas = new unsigned char[width * height * channels];
+  memset(canvas, 235, width * height * channels);
+  for (int y = 0; y < photo.height; y++) {
+    memcpy(canvas + y * width * channels,
+           photo.data.get() + y * photo.width * channels,
+           photo.width * channels);
+  }
+  return Image(canvas, width, height, channels);
+}
+template <bool SkipFlat>
+static void BM_MostlyFlatCanvas(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = mostlyFlatCanvas();
+  SparseKernel kernel = SparseKernel::compile(kernels[Filter::LowPass3x3]);
+  img.padReplication(kernel.size / 2);
+  for (auto _ : state) {
+    Image outputImage = SkipFlat
+                            ? applyKernelSparseSkipFlat(img, kernel, nthreads)
+                            : applyKernelSparse(img, kernel, nthreads);
+  }
+}
+// Skipped tiles cost almost nothing, so a static split leaves the workers
+// owning the photo corner with most of the work
+template <ExecutorKind Kind>
+static void BM_FlatCanvasScheduling(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = mostlyFlatCanvas();
+  SparseKernel kernel = SparseKernel::compile(kernels[Filter::LowPass3x3]);
+  img.padReplication(kernel.size / 2);
+  std::unique_ptr<Executor> executor = makeExecutor(Kind, nthreads);
+  for (auto _ : state) {
+    Image outputImage = applyKernelSparseSkipFlat(img, kernel, *executor);
+  }
+}
+template <ExecutorKind Kind>
+static void BM_ConvolveExecutor(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  img.padReplication(kernel.size() / 2);
+  std::unique_ptr<Executor> executor = makeExecutor(Kind, nthreads);
+  for (auto _ : state) {
+    Image outputImage = convolve(img, kernel, *executor);
+  }
+}
+// The dense loop of applyKernelOpenMp (compare with BM_OpenMP) on an
+// executor
+template <ExecutorKind Kind>
+static void BM_DirectExecutor(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::LowPass3x3];
+  img.padReplication(kernel.size() / 2);
+  std::unique_ptr<Executor> executor = makeExecutor(Kind, nthreads);
+  for (auto _ : state) {
+    Image outputImage = applyKernelDirect(img, kernel, *executor);
+  }
+}
+// Sparse convolution on a row-band pool, with the input as loaded (touched
+// by the loading thread) or redistributed with placeRowBands()
+template <bool Place>
+static void BM_RowBandPlacement(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image img = Image::load(inputFile);
+  SparseKernel kernel = SparseKernel::compile(kernels[Filter::LowPass5x5]);
+  img.padReplication(kernel.size / 2);
+  ThreadPool pool(nthreads, true, PoolSchedule::RowBands);
+  if (Place) {
+    img = placeRowBands(img, pool);
+  }
+  for (auto _ : state) {
+    Image outputImage = applyKernelSparse(img, kernel, pool);
+  }
+}
+// A batch of small images: 96x96 crops of the wallpaper, filtered one by
+// one with the same thread count, forking an OpenMP region per pass or on a
+// ProcessingContext pool
+template <bool Pool>
+static void BM_SmallImageBatch(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image photo = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  const int side = 96;
+  const int channels = photo.channels;
+  std::vector<Image> batch;
+  for (int y = 0; y + side <= photo.height && batch.size() < 512; y += side) {
+    for (int x = 0; x + side <= photo.width && batch.size() < 512; x += side) {
+      unsigned char *crop = new unsigned char[side * side * channels];
+      for (int row = 0; row < side; row++) {
+        memcpy(crop + row * side * channels,
+               photo.data.get() + ((y + row) * photo.width + x) * channels,
+               side * channels);
+      }
+      batch.emplace_back(crop, side, side, channels);
+      batch.back().padReplication(kernel.size() / 2);
+    }
+  }
+  ProcessingContext context(nthreads);
+#ifdef OPENMP
+  OpenMpExecutor forked(nthreads);
+  Executor &executor = Pool ? context.executor() : forked;
+#else
+  Executor &executor = context.executor();
+#endif
+  for (auto _ : state) {
+    for (Image &img : batch) {
+      Image outputImage = convolve(img, kernel, executor);
+    }
+  }
+}
+
+// The full photo among 64 thumbnails cropped from it: one image at a time
+// with every thread inside it, or all of them on a BatchProcessor
+template <bool Batch>
+static void BM_MixedBatch(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image photo = Image::load(inputFile);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  const int side = 128;
+  const int channels = photo.channels;
+  std::vector<Image> inputs;
+  inputs.emplace_back(new unsigned char[static_cast<size_t>(photo.width) *
+                                        photo.height * channels],
+                      photo.width, photo.height, channels);
+  memcpy(inputs.back().data.get(), photo.data.get(),
+         static_cast<size_t>(photo.width) * photo.height * channels);
+  for (int i = 0; i < 64; i++) {
+    const int x = (i % 8) * side, y = (i / 8) * side;
+    unsigned char *crop = new unsigned char[side * side * channels];
+    for (int row = 0; row < side; row++) {
+      memcpy(crop + row * side * channels,
+             photo.data.get() + ((y + row) * photo.width + x) * channels,
+             side * channels);
+    }
+    inputs.emplace_back(crop, side, side, channels);
+  }
+  std::vector<BatchItem> items;
+  for (const Image &img : inputs) {
+    BatchItem item;
+    item.bytes = static_cast<size_t>(img.width) * img.height * img.channels;
+    item.load = [&img] {
+      const size_t bytes =
+          static_cast<size_t>(img.width) * img.height * img.channels;
+      unsigned char *copy = new unsigned char[bytes];
+      memcpy(copy, img.data.get(), bytes);
+      return Image(copy, img.width, img.height, img.channels);
+    };
+    items.push_back(item);
+  }
+  auto filter = [&](Image &img, Executor &executor) {
+    img.padReplication(kernel.size() / 2);
+    return convolve(img, kernel, executor);
+  };
+
+  ProcessingContext context(nthreads);
+  BatchProcessor batch(nthreads, size_t(1) << 30);
+  for (auto _ : state) {
+    if (Batch) {
+      batch.process(items, filter, [](size_t, Image &) {});
+    } else {
+      for (const BatchItem &item : items) {
+        Image img = item.load();
+        Image outputImage = filter(img, context.executor());
+      }
+    }
+  }
+}
+
+// Four copies of the photo at half size decoded from and encoded to PNG in
+// memory: one stage after the other, or as a pipeline whose stages overlap
+static std::vector<unsigned char> encodePng(const Image &img) {
+  std::vector<unsigned char> png;
+  stbi_write_png_to_func(
+      [](void *context, void *data, int size) {
+        auto *out = static_cast<std::vector<unsigned char> *>(context);
+        out->insert(out->end(), static_cast<unsigned char *>(data),
+                    static_cast<unsigned char *>(data) + size);
+      },
+      &png, img.width, img.height, img.channels, img.data.get(),
+      img.width * img.channels);
+  return png;
+}
+
+template <bool Pipelined>
+static void BM_DecodeFilterEncode(benchmark::State &state) {
+  auto nthreads = state.range(0);
+
+  Image photo = Image::load(inputFile);
+  const std::vector<unsigned char> png = encodePng(resize(
+      photo, photo.width / 2, photo.height / 2, ResampleFilter::Box, 1));
+  std::vector<BatchItem> items(4);
+  for (BatchItem &item : items) {
+    item.load = [&] {
+      int width, height, channels;
+      unsigned char *data = stbi_load_from_memory(
+          png.data(), png.size(), &width, &height, &channels, 0);
+      return Image(data, width, height, channels);
+    };
+  }
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  auto filter = [&](Image &img, Executor &executor) {
+    img.padReplication(kernel.size() / 2);
+    return convolve(img, kernel, executor);
+  };
+  auto encode = [](size_t, Image &result) {
+    benchmark::DoNotOptimize(encodePng(result));
+  };
+
+  ThreadPool pool(nthreads);
+  PipelineOptions options;
+  options.filterThreads = nthreads;
+  for (auto _ : state) {
+    if (Pipelined) {
+      runPipeline(items, filter, encode, options);
+    } else {
+      for (size_t i = 0; i < items.size(); i++) {
+        Image img = items[i].load();
+        Image outputImage = filter(img, pool);
+        encode(i, outputImage);
+      }
+    }
+  }
+}
 
 // Register the function as a benchmark
 BENCHMARK(BM_Sequential)->Unit(benchmark::kMillisecond);
+#ifdef OPENMP
 BENCHMARK(BM_OpenMP)->DenseRange(4, 256, 4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ResizeThenBlur)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+#endif
+BENCHMARK(BM_ResizeAndBlurFused)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_NonLocalMeans)->RangeMultiplier(2)->Range(1, 32)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve3x3, ConvolutionBackend::Direct)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve3x3, ConvolutionBackend::Winograd)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve3x3, ConvolutionBackend::Sparse)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve3x3, ConvolutionBackend::Jit)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve3x3, ConvolutionBackend::Lut)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve5x5, ConvolutionBackend::Direct)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve5x5, ConvolutionBackend::Sparse)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve5x5, ConvolutionBackend::LowRank)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve5x5, ConvolutionBackend::Jit)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Convolve5x5, ConvolutionBackend::Lut)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_LowRankColumnPass8K, ColumnPass::Rows)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_LowRankColumnPass8K, ColumnPass::Transposed)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RepeatedPasses8)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Iterated8)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MostlyFlatCanvas, false)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MostlyFlatCanvas, true)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ConvolveExecutor, ExecutorKind::Sequential)->Arg(1)->Unit(benchmark::kMillisecond);
+#ifdef OPENMP
+BENCHMARK_TEMPLATE(BM_ConvolveExecutor, ExecutorKind::OpenMp)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FlatCanvasScheduling, ExecutorKind::OpenMp)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+#endif
+BENCHMARK_TEMPLATE(BM_ConvolveExecutor, ExecutorKind::WorkStealing)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FlatCanvasScheduling, ExecutorKind::WorkStealing)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_RowBandPlacement, false)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_RowBandPlacement, true)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+#ifdef OPENMP
+BENCHMARK_TEMPLATE(BM_SmallImageBatch, false)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+#endif
+BENCHMARK_TEMPLATE(BM_SmallImageBatch, true)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MixedBatch, false)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MixedBatch, true)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DecodeFilterEncode, false)->RangeMultiplier(2)->Range(1, 4)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DecodeFilterEncode, true)->RangeMultiplier(2)->Range(1, 4)->UseRealTime()->Unit(benchmark::kMillisecond);
+#ifdef OPENMP
+BENCHMARK_TEMPLATE(BM_DirectExecutor, ExecutorKind::OpenMp)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond);
+#endif
+#ifdef PARAFILTER_PSTL
+BENCHMARK_TEMPLATE(BM_DirectExecutor, ExecutorKind::ParallelStl)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ConvolveExecutor, ExecutorKind::ParallelStl)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+#endif
 // Run the benchmark
 BENCHMARK_MAIN();
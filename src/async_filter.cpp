@@ -0,0 +1,109 @@
+#include "include/async_filter.h"
+
+FilterCancelled::FilterCancelled(Reason reason)
+    : std::runtime_error(reason == Reason::Cancelled
+                             ? "filter request cancelled"
+                             : "filter request missed its deadline"),
+      why(reason) {}
+
+CancellableExecutor::CancellableExecutor(Executor &inner,
+                                         CancellationToken token,
+                                         Deadline deadline)
+    : inner(inner), token(std::move(token)), deadline(deadline) {}
+
+void CancellableExecutor::check() const {
+  if (token.cancelled()) {
+    throw FilterCancelled(FilterCancelled::Reason::Cancelled);
+  }
+  if (deadline != NO_DEADLINE &&
+      std::chrono::steady_clock::now() >= deadline) {
+    throw FilterCancelled(FilterCancelled::Reason::DeadlineExceeded);
+  }
+}
+
+void CancellableExecutor::parallelFor(int count, const Task &task) {
+  check();
+  inner.parallelFor(count, [&](int i, int worker) {
+    check();
+    task(i, worker);
+  });
+}
+
+AsyncFilter::AsyncFilter(int nthreads)
+    : pool(nthreads), dispatcher(&AsyncFilter::dispatch, this) {}
+
+AsyncFilter::~AsyncFilter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_one();
+  dispatcher.join();
+  for (Request &request : requests) {
+    request.result.set_exception(std::make_exception_ptr(
+        FilterCancelled(FilterCancelled::Reason::Cancelled)));
+  }
+}
+
+void AsyncFilter::dispatch() {
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queued.wait(lock, [&] { return stopping || !requests.empty(); });
+      if (stopping) {
+        return;
+      }
+      request = std::move(requests.front());
+      requests.pop_front();
+    }
+    CancellableExecutor executor(pool, request.token, request.deadline);
+    try {
+      // Requests abandoned while queued never start
+      executor.check();
+      request.result.set_value(request.work(executor));
+    } catch (...) {
+      request.result.set_exception(std::current_exception());
+    }
+  }
+}
+
+std::future<Image> AsyncFilter::submit(Work work, CancellationToken token,
+                                       Deadline deadline) {
+  Request request;
+  request.work = std::move(work);
+  request.token = std::move(token);
+  request.deadline = deadline;
+  std::future<Image> result = request.result.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.push_back(std::move(request));
+  }
+  queued.notify_one();
+  return result;
+}
+
+std::future<Image> AsyncFilter::applyKernel(Image img, const Kernel &kernel,
+                                            CancellationToken token,
+                                            Deadline deadline,
+                                            const ConvolutionOptions &options) {
+  // Work must be copyable, the image is not
+  auto input = std::make_shared<Image>(std::move(img));
+  return submit(
+      [input, kernel, options](Executor &executor) {
+        return convolve(*input, kernel, executor, options);
+      },
+      std::move(token), deadline);
+}
+
+std::future<Image> AsyncFilter::unsharpMask(Image img,
+                                            const UnsharpMaskParams &params,
+                                            CancellationToken token,
+                                            Deadline deadline) {
+  auto input = std::make_shared<Image>(std::move(img));
+  return submit(
+      [input, params](Executor &executor) {
+        return ::unsharpMask(*input, params, executor);
+      },
+      std::move(token), deadline);
+}
@@ -0,0 +1,254 @@
+#include "include/batch_processor.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+struct BatchProcessor::Call {
+  Task task;
+  int count = 0;
+  int grain = 1;
+  // Batch item the call belongs to; lower runs first
+  size_t sequence = 0;
+  // Guarded by the processor's mutex
+  int next = 0;
+  int running = 0;
+  bool done = false;
+  std::exception_ptr error;
+  // Set by the first throwing task so chunks already handed out stop early
+  std::atomic<bool> failed{false};
+};
+
+namespace {
+constexpr size_t NO_ITEM = std::numeric_limits<size_t>::max();
+
+// Processor the current thread works for and its worker index there
+thread_local const BatchProcessor *workerOf = nullptr;
+thread_local int workerIndex = 0;
+// Calls the current thread is running a task of, innermost last
+thread_local std::vector<const void *> activeCalls;
+// Batch item of the task the current thread runs
+thread_local size_t currentItem = NO_ITEM;
+} // namespace
+
+BatchItem fileItem(const std::string &path) {
+  int width, height, channels;
+  if (!stbi_info(path.c_str(), &width, &height, &channels)) {
+    throw std::runtime_error(path + ": " + stbi_failure_reason());
+  }
+  BatchItem item;
+  item.bytes = static_cast<size_t>(width) * height * channels;
+  item.load = [path] { return Image::load(path.c_str()); };
+  return item;
+}
+
+BatchProcessor::BatchProcessor(int nthreads, size_t memoryBudget)
+    : budget(memoryBudget) {
+  nthreads = std::max(1, nthreads);
+  threads.reserve(nthreads);
+  for (int worker = 0; worker < nthreads; worker++) {
+    threads.emplace_back(&BatchProcessor::workerLoop, this, worker);
+  }
+}
+
+BatchProcessor::~BatchProcessor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+std::shared_ptr<BatchProcessor::Call>
+BatchProcessor::submit(int count, const Task &task, size_t sequence) {
+  auto call = std::make_shared<Call>();
+  call->task = task;
+  call->count = count;
+  call->grain = std::max(1, count / (CHUNKS_PER_WORKER * workers()));
+  call->sequence = sequence;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    calls.push_back(call);
+  }
+  changed.notify_all();
+  return call;
+}
+
+bool BatchProcessor::runChunk(std::unique_lock<std::mutex> &lock,
+                              const Call *awaited) {
+  if (workerOf != this) {
+    return false;
+  }
+  // The awaited call first, then the oldest item's calls, innermost first,
+  // skipping calls whose tasks this thread already has on its stack
+  int chosen = -1;
+  for (int i = 0; i < static_cast<int>(calls.size()); i++) {
+    const Call *call = calls[i].get();
+    if (call == awaited) {
+      chosen = i;
+      break;
+    }
+    if (std::find(activeCalls.begin(), activeCalls.end(), call) !=
+        activeCalls.end()) {
+      continue;
+    }
+    if (chosen < 0 || call->sequence <= calls[chosen]->sequence) {
+      chosen = i;
+    }
+  }
+  if (chosen < 0) {
+    return false;
+  }
+  std::shared_ptr<Call> call = calls[chosen];
+  const int begin = call->next;
+  const int end = std::min(call->count, begin + call->grain);
+  call->next = end;
+  call->running++;
+  if (end == call->count) {
+    calls.erase(calls.begin() + chosen);
+  }
+  lock.unlock();
+
+  std::exception_ptr thrown;
+  const size_t outerItem = currentItem;
+  currentItem = call->sequence;
+  activeCalls.push_back(call.get());
+  try {
+    for (int i = begin;
+         i < end && !call->failed.load(std::memory_order_relaxed); i++) {
+      call->task(i, workerIndex);
+    }
+  } catch (...) {
+    thrown = std::current_exception();
+    call->failed = true;
+  }
+  activeCalls.pop_back();
+  currentItem = outerItem;
+
+  lock.lock();
+  if (thrown) {
+    if (!call->error) {
+      call->error = thrown;
+    }
+    // Stop handing out the remaining tasks
+    if (call->next < call->count) {
+      call->next = call->count;
+      calls.erase(std::find(calls.begin(), calls.end(), call));
+    }
+  }
+  call->running--;
+  if (call->next == call->count && call->running == 0) {
+    call->done = true;
+    changed.notify_all();
+  }
+  return true;
+}
+
+void BatchProcessor::workerLoop(int worker) {
+  workerOf = this;
+  workerIndex = worker;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    if (!runChunk(lock, nullptr)) {
+      changed.wait(lock);
+    }
+  }
+}
+
+void BatchProcessor::parallelFor(int count, const Task &task) {
+  if (count <= 0) {
+    return;
+  }
+  // A single task of a worker needs nobody else
+  if (count == 1 && workerOf == this) {
+    task(0, workerIndex);
+    return;
+  }
+  std::shared_ptr<Call> call = submit(count, task, currentItem);
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!call->done) {
+    if (!runChunk(lock, call.get())) {
+      changed.wait(lock);
+    }
+  }
+  if (call->error) {
+    std::rethrow_exception(call->error);
+  }
+}
+
+bool BatchProcessor::admit(size_t bytes) {
+  std::unique_lock<std::mutex> lock(admissionMutex);
+  bool waited = false;
+  while (!failed && imagesInFlight > 0 && bytesInFlight + bytes > budget) {
+    waited = true;
+    released.wait(lock);
+  }
+  if (failed) {
+    return false;
+  }
+  bytesInFlight += bytes;
+  imagesInFlight++;
+  current.images++;
+  current.waits += waited;
+  current.peakInFlight = std::max(current.peakInFlight, imagesInFlight);
+  current.peakBytes = std::max(current.peakBytes, bytesInFlight);
+  return true;
+}
+
+void BatchProcessor::release(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(admissionMutex);
+    bytesInFlight -= bytes;
+    imagesInFlight--;
+  }
+  released.notify_all();
+}
+
+void BatchProcessor::process(const std::vector<BatchItem> &items,
+                             const Filter &filter, const Sink &sink) {
+  std::lock_guard<std::mutex> serial(processMutex);
+  {
+    std::lock_guard<std::mutex> lock(admissionMutex);
+    current = BatchStats();
+    failed = false;
+    error = nullptr;
+  }
+  for (size_t i = 0; i < items.size(); i++) {
+    const size_t footprint =
+        static_cast<size_t>(items[i].bytes * FOOTPRINT_FACTOR);
+    if (!admit(footprint)) {
+      break;
+    }
+    // Each image is a call of its own, so its nested calls inherit its
+    // position in the batch
+    submit(
+        1,
+        [&, i, footprint](int, int) {
+          try {
+            Image img = items[i].load();
+            Image result = filter(img, *this);
+            sink(i, result);
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(admissionMutex);
+            if (!error) {
+              error = std::current_exception();
+            }
+            failed = true;
+          }
+          release(footprint);
+        },
+        i);
+  }
+  std::unique_lock<std::mutex> lock(admissionMutex);
+  released.wait(lock, [&] { return imagesInFlight == 0; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+BatchStats BatchProcessor::stats() const {
+  std::lock_guard<std::mutex> lock(admissionMutex);
+  return current;
+}
@@ -0,0 +1,106 @@
+#include "include/box_filter.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+// Width of the column strips handled by one thread in the vertical pass
+constexpr int STRIP = 256;
+
+// Number of samples covered by the cropped window centered on each index
+std::vector<float> inverseCounts(int size, int radius) {
+  std::vector<float> result(size);
+  for (int i = 0; i < size; i++) {
+    int count = std::min(i + radius, size - 1) - std::max(i - radius, 0) + 1;
+    result[i] = 1.0f / count;
+  }
+  return result;
+}
+} // namespace
+
+FloatImage boxMean(const FloatImage &img, int radius, Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  FloatImage sums(width, height, channels);
+  FloatImage result(width, height, channels);
+
+  // Horizontal running sums
+  executor.parallelFor(height, [&](int y, int) {
+    const float *in = img.row(y);
+    float *out = sums.row(y);
+    for (int c = 0; c < channels; c++) {
+      float sum = 0.0f;
+      for (int x = 0; x <= std::min(radius, width - 1); x++) {
+        sum += in[x * channels + c];
+      }
+      for (int x = 0; x < width; x++) {
+        out[x * channels + c] = sum;
+        if (x + radius + 1 < width) {
+          sum += in[(x + radius + 1) * channels + c];
+        }
+        if (x - radius >= 0) {
+          sum -= in[(x - radius) * channels + c];
+        }
+      }
+    }
+  });
+
+  std::vector<float> invX = inverseCounts(width, radius);
+  std::vector<float> invY = inverseCounts(height, radius);
+  std::vector<float> invRow(rowLen);
+  for (int j = 0; j < rowLen; j++) {
+    invRow[j] = invX[j / channels];
+  }
+
+  // Vertical running sums over column strips, normalized on the way out
+  const int strips = (rowLen + STRIP - 1) / STRIP;
+  std::vector<std::vector<float>> scratch(executor.workers());
+  executor.parallelFor(strips, [&](int s, int worker) {
+    std::vector<float> &acc = scratch[worker];
+    if (acc.empty()) {
+      acc.resize(STRIP);
+    }
+    const int j0 = s * STRIP;
+    const int len = std::min(STRIP, rowLen - j0);
+    float *a = acc.data();
+    std::fill(a, a + len, 0.0f);
+    for (int y = 0; y <= std::min(radius, height - 1); y++) {
+      const float *in = sums.row(y) + j0;
+#pragma omp simd
+      for (int j = 0; j < len; j++) {
+        a[j] += in[j];
+      }
+    }
+    const float *inv = invRow.data() + j0;
+    for (int y = 0; y < height; y++) {
+      float *out = result.row(y) + j0;
+      const float scale = invY[y];
+#pragma omp simd
+      for (int j = 0; j < len; j++) {
+        out[j] = a[j] * inv[j] * scale;
+      }
+      if (y + radius + 1 < height) {
+        const float *add = sums.row(y + radius + 1) + j0;
+#pragma omp simd
+        for (int j = 0; j < len; j++) {
+          a[j] += add[j];
+        }
+      }
+      if (y - radius >= 0) {
+        const float *sub = sums.row(y - radius) + j0;
+#pragma omp simd
+        for (int j = 0; j < len; j++) {
+          a[j] -= sub[j];
+        }
+      }
+    }
+  });
+  return result;
+}
+
+FloatImage boxMean(const FloatImage &img, int radius, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return boxMean(img, radius, executor);
+}
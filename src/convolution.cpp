@@ -0,0 +1,174 @@
+#include "include/convolution.h"
+#include "include/iterated_kernel.h"
+#include "include/jit_kernel.h"
+#include "include/kernel_decomposition.h"
+#include "include/lut_kernel.h"
+#include "include/processing_context.h"
+#include "include/sparse_kernel.h"
+#include "include/winograd.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// Cost of one tap of a separable term (multiply-add in both passes), same
+// units
+constexpr float LOW_RANK_COST_PER_TAP = 4.0f;
+// Cost of one non-zero tap (load + FMA) of the JIT routine, same units
+constexpr float JIT_COST_PER_TAP = 1.2f;
+} // namespace
+
+const char *backendName(ConvolutionBackend backend) {
+  switch (backend) {
+  case ConvolutionBackend::Auto:
+    return "auto";
+  case ConvolutionBackend::Direct:
+    return "direct";
+  case ConvolutionBackend::Winograd:
+    return "winograd";
+  case ConvolutionBackend::Sparse:
+    return "sparse";
+  case ConvolutionBackend::LowRank:
+    return "low-rank";
+  case ConvolutionBackend::Jit:
+    return "jit";
+  case ConvolutionBackend::Lut:
+    return "lut";
+  }
+  return "unknown";
+}
+
+ConvolutionBackend selectBackend(const Image &img, const Kernel &kernel,
+                                 const ConvolutionOptions &options) {
+  const float size = kernel.size();
+  SparseKernel sparse = SparseKernel::compile(kernel);
+  float sparseCost = sparse.nonZeroTaps + sparse.groups.size();
+  // Every separable term is two 1D passes of `size` multiply-adds each
+  int rank = KernelDecomposition::analyze(kernel).rankFor(
+      options.lowRankTolerance);
+  float lowRankCost = rank * LOW_RANK_COST_PER_TAP * size;
+  float jitCost = JitKernel::get(kernel, img.channels)
+                      ? JIT_COST_PER_TAP * sparse.nonZeroTaps
+                      : sparseCost;
+
+  // Winograd is never picked here: BM_Convolve3x3 on a 4K image at one
+  // thread takes 185 ms with it against 53 ms sparse and 58 ms JIT
+  if (lowRankCost < std::min(sparseCost, jitCost)) {
+    return ConvolutionBackend::LowRank;
+  }
+  if (jitCost < sparseCost) {
+    return ConvolutionBackend::Jit;
+  }
+  // The grouped row-wise loop never costs more than the dense direct one
+  return ConvolutionBackend::Sparse;
+}
+
+Image applyKernelDirect(const Image &img, const Kernel &kernel,
+                        Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int kHalf = kernel.size() / 2;
+  const unsigned char *src = img.data.get();
+
+  const int rowLen = width * channels;
+  unsigned char *output = new unsigned char[width * height * channels];
+  // Border rows here, border columns by the worker owning each row (see
+  // applyKernelSparse)
+  memcpy(output, src, kHalf * rowLen);
+  memcpy(output + (height - kHalf) * rowLen, src + (height - kHalf) * rowLen,
+         kHalf * rowLen);
+
+  std::vector<std::vector<float>> scratch(executor.workers());
+  executor.parallelFor(height - 2 * kHalf, [&](int task, int worker) {
+    std::vector<float> &sum = scratch[worker];
+    sum.resize(channels);
+    const int y = kHalf + task;
+    const int border = kHalf * channels;
+    memcpy(output + y * rowLen, src + y * rowLen, border);
+    memcpy(output + (y + 1) * rowLen - border, src + (y + 1) * rowLen - border,
+           border);
+    for (int x = kHalf; x < width - kHalf; x++) {
+      std::fill(sum.begin(), sum.end(), 0.0f);
+      for (int ky = -kHalf; ky <= kHalf; ky++) {
+        for (int kx = -kHalf; kx <= kHalf; kx++) {
+          const unsigned char *pixel =
+              src + ((y + ky) * width + x + kx) * channels;
+          for (int c = 0; c < channels; c++) {
+            sum[c] += pixel[c] * kernel[ky + kHalf][kx + kHalf];
+          }
+        }
+      }
+      unsigned char *outPixel = output + (y * width + x) * channels;
+      for (int c = 0; c < channels; c++) {
+        outPixel[c] = static_cast<unsigned char>(clamp((int)sum[c], 0, 255));
+      }
+      if (channels == 4) {
+        outPixel[3] = src[(y * width + x) * channels + 3];
+      }
+    }
+  });
+  return Image(output, width, height, channels);
+}
+
+Image convolve(Image &img, const Kernel &kernel, Executor &executor,
+               const ConvolutionOptions &options) {
+  if (options.iterations < 1) {
+    throw std::runtime_error("iterations must be at least 1");
+  }
+  if (options.iterations > 1) {
+    if (options.backend == ConvolutionBackend::Auto ||
+        options.backend == ConvolutionBackend::Sparse) {
+      return applyKernelIterated(img, SparseKernel::compile(kernel),
+                                 options.iterations, executor);
+    }
+    ConvolutionOptions single = options;
+    single.iterations = 1;
+    Image result = convolve(img, kernel, executor, single);
+    for (int i = 1; i < options.iterations; i++) {
+      result = convolve(result, kernel, executor, single);
+    }
+    return result;
+  }
+
+  ConvolutionBackend backend = options.backend;
+  if (backend == ConvolutionBackend::Auto) {
+    backend = selectBackend(img, kernel, options);
+  }
+
+  if (options.skipFlatTiles && backend == ConvolutionBackend::Sparse) {
+    return applyKernelSparseSkipFlat(img, SparseKernel::compile(kernel),
+                                     executor, options.flatTileStats);
+  }
+
+  switch (backend) {
+  case ConvolutionBackend::Winograd:
+    if (kernel.size() != 3) {
+      throw std::runtime_error("Winograd backend needs a 3x3 kernel");
+    }
+    return applyKernelWinograd3x3(img, kernel, executor);
+  case ConvolutionBackend::Sparse:
+    return applyKernelSparse(img, SparseKernel::compile(kernel), executor);
+  case ConvolutionBackend::LowRank: {
+    KernelDecomposition decomposition = KernelDecomposition::analyze(kernel);
+    return applyKernelLowRank(img, decomposition,
+                              decomposition.rankFor(options.lowRankTolerance),
+                              executor, options.columnPass);
+  }
+  case ConvolutionBackend::Jit:
+    return applyKernelJit(img, kernel, executor);
+  case ConvolutionBackend::Lut:
+    return applyKernelLut(img, LutKernel::compile(kernel), executor);
+  case ConvolutionBackend::Auto:
+  case ConvolutionBackend::Direct:
+    break;
+  }
+  return applyKernelDirect(img, kernel, executor);
+}
+
+Image convolve(Image &img, const Kernel &kernel, int nthreads,
+               const ConvolutionOptions &options) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return convolve(img, kernel, executor, options);
+}
@@ -0,0 +1,537 @@
+#include "include/distributed.h"
+#include "include/convolution.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr int ROOT = 0;
+// Tags of the halo messages, by the direction the data travels
+constexpr int TAG_UP = 0;
+constexpr int TAG_DOWN = 1;
+constexpr int TAG_LEFT = 2;
+constexpr int TAG_RIGHT = 3;
+// Tags of whole blocks sent by and back to the root
+constexpr int TAG_BLOCK = 4;
+constexpr int TAG_RESULT = 5;
+// Bands the overlapped parts are filtered in, testing the halos in between:
+// most MPI libraries only move rendezvous messages inside MPI calls
+constexpr int OVERLAP_BANDS = 8;
+
+struct Shape {
+  int width, height, channels;
+};
+
+// The root's image size, on every rank
+Shape broadcastShape(const Image &img, MPI_Comm comm) {
+  int dims[3] = {img.width, img.height, img.channels};
+  MPI_Bcast(dims, 3, MPI_INT, ROOT, comm);
+  return {dims[0], dims[1], dims[2]};
+}
+
+// Processes of comm that share this one's node
+int ranksOnNode(MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm nodeComm;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                      &nodeComm);
+  int ranks;
+  MPI_Comm_size(nodeComm, &ranks);
+  MPI_Comm_free(&nodeComm);
+  return ranks;
+}
+
+// Threads for filtering `samples` on this rank's share of its node
+ThreadDecision rankThreads(long samples, const Kernel &kernel,
+                           MPI_Comm comm, ThreadDecision *decision) {
+  ThreadDecision choice =
+      chooseThreadCount(samples, kernelOpsPerSample(kernel),
+                        CpuTopology::system().sharedBy(ranksOnNode(comm)));
+  if (decision) {
+    *decision = choice;
+  }
+  return choice;
+}
+
+// `count` runs of `length` bytes, `stride` bytes apart
+MPI_Datatype vectorType(int count, int length, int stride) {
+  MPI_Datatype type;
+  MPI_Type_vector(count, length, stride, MPI_UNSIGNED_CHAR, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+// Halo messages in flight and when they were seen complete
+struct Exchange {
+  std::vector<MPI_Request> requests;
+  double posted = MPI_Wtime();
+  double done = -1;
+
+  void test() {
+    int flag = 0;
+    if (done < 0) {
+      MPI_Testall(requests.size(), requests.data(), &flag,
+                  MPI_STATUSES_IGNORE);
+    }
+    if (flag) {
+      done = MPI_Wtime();
+    }
+  }
+
+  // Seconds blocked until every message completed
+  double wait() {
+    if (done >= 0) {
+      return 0;
+    }
+    const double begin = MPI_Wtime();
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    done = MPI_Wtime();
+    return done - begin;
+  }
+
+  double seconds() const { return done - posted; }
+};
+
+// A local block's rows are only contiguous when it spans the whole image
+void keepData(unsigned char *) {}
+
+// Filters `rect` of the local block into the same place of `output`, in
+// bands between which the halos of `pending` get a chance to progress
+void filterRect(const Image &block, unsigned char *output, BlockRect rect,
+                const Kernel &kernel, Executor &executor,
+                const ConvolutionOptions &options, Exchange *pending) {
+  const int halo = kernel.size() / 2;
+  const int channels = block.channels;
+  const int rowLen = block.width * channels;
+  const int cols = rect.x1 - rect.x0 + 2 * halo;
+  const int colLen = cols * channels;
+  const int rows = rect.y1 - rect.y0;
+  // Even bands keep Winograd's 2x2 tiles where a single pass puts them
+  int band = (rows + OVERLAP_BANDS - 1) / OVERLAP_BANDS;
+  band += band % 2;
+  for (int y0 = rect.y0; y0 < rect.y1; y0 += band) {
+    const int y1 = std::min(rect.y1, y0 + band);
+    const int inputRows = y1 - y0 + 2 * halo;
+    unsigned char *corner = block.data.get() + (y0 - halo) * rowLen +
+                            (rect.x0 - halo) * channels;
+    Image input;
+    if (cols == block.width) {
+      input = Image(corner, cols, inputRows, channels, keepData);
+    } else {
+      unsigned char *copy = new unsigned char[inputRows * colLen];
+      for (int y = 0; y < inputRows; y++) {
+        memcpy(copy + y * colLen, corner + y * rowLen, colLen);
+      }
+      input = Image(copy, cols, inputRows, channels);
+    }
+    Image filtered = convolve(input, kernel, executor, options);
+    for (int y = halo; y < inputRows - halo; y++) {
+      memcpy(output + (y0 - halo + y) * rowLen + rect.x0 * channels,
+             filtered.data.get() + y * colLen + halo * channels,
+             (cols - 2 * halo) * channels);
+    }
+    if (pending) {
+      pending->test();
+    }
+  }
+}
+
+// Filters a local block following planOverlap(): the interior while `rows`
+// are in flight, the row edges once they arrived, while the exchange
+// `postColumns` starts, if any, is in flight, and the column edges last
+Image filterOverlapped(const Image &block, const OverlapPlan &plan,
+                       const Kernel &kernel, int threads, Exchange &rows,
+                       const std::function<Exchange()> &postColumns,
+                       DistributedTimings &timings) {
+  Executor &executor = ProcessingContext::shared(threads).executor();
+  // Every part runs the backend the whole block would, so the result does
+  // not depend on how the image was split
+  ConvolutionOptions options;
+  options.backend = selectBackend(block, kernel);
+  const int halo = kernel.size() / 2;
+  const int rowLen = block.width * block.channels;
+  unsigned char *output = new unsigned char[block.height * rowLen];
+
+  double begin = MPI_Wtime();
+  filterRect(block, output, plan.interior, kernel, executor, options, &rows);
+  timings.overlappedSeconds += MPI_Wtime() - begin;
+  timings.haloWaitSeconds += rows.wait();
+
+  Exchange columns;
+  if (postColumns) {
+    columns = postColumns();
+  }
+  begin = MPI_Wtime();
+  for (BlockRect rect : plan.rowEdges) {
+    filterRect(block, output, rect, kernel, executor, options,
+               postColumns ? &columns : nullptr);
+  }
+  (postColumns ? timings.overlappedSeconds : timings.boundarySeconds) +=
+      MPI_Wtime() - begin;
+  timings.haloWaitSeconds += columns.wait();
+  timings.haloSeconds += rows.seconds() + columns.seconds();
+
+  begin = MPI_Wtime();
+  for (BlockRect rect : plan.columnEdges) {
+    filterRect(block, output, rect, kernel, executor, options, nullptr);
+  }
+  // The halo ring, which holds the padding of blocks on the image edge
+  const int border = halo * block.channels;
+  memcpy(output, block.data.get(), halo * rowLen);
+  for (int y = halo; y < block.height - halo; y++) {
+    memcpy(output + y * rowLen, block.data.get() + y * rowLen, border);
+    memcpy(output + (y + 1) * rowLen - border,
+           block.data.get() + (y + 1) * rowLen - border, border);
+  }
+  memcpy(output + (block.height - halo) * rowLen,
+         block.data.get() + (block.height - halo) * rowLen, halo * rowLen);
+  timings.boundarySeconds += MPI_Wtime() - begin;
+  return Image(output, block.width, block.height, block.channels);
+}
+
+// Every phase's slowest rank, on the root
+void reduceTimings(DistributedTimings &timings, MPI_Comm comm,
+                   DistributedTimings *result) {
+  double local[6] = {timings.scatterSeconds,  timings.overlappedSeconds,
+                     timings.haloSeconds,     timings.haloWaitSeconds,
+                     timings.boundarySeconds, timings.gatherSeconds};
+  double slowest[6];
+  MPI_Reduce(local, slowest, 6, MPI_DOUBLE, MPI_MAX, ROOT, comm);
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (result && rank == ROOT) {
+    result->scatterSeconds = slowest[0];
+    result->overlappedSeconds = slowest[1];
+    result->haloSeconds = slowest[2];
+    result->haloWaitSeconds = slowest[3];
+    result->boundarySeconds = slowest[4];
+    result->gatherSeconds = slowest[5];
+  } else if (result) {
+    *result = timings;
+  }
+}
+
+Image runStripes(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                 Shape shape, ThreadDecision *decision,
+                 DistributedTimings *result) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  const int halo = kernel.size() / 2;
+  const int rowLen = shape.width * shape.channels;
+  const StripePartition partition =
+      partitionStripes(shape.height, halo, size);
+  DistributedTimings timings;
+
+  std::vector<int> counts(size), displs(size);
+  for (int r = 0; r < size; r++) {
+    counts[r] = partition.rows[r] * rowLen;
+    displs[r] = partition.first[r] * rowLen;
+  }
+
+  // Local stripe: halo rows above, the rows filtered here, halo rows below.
+  // The first and last ranks receive their padding rows as those halos.
+  const int interior = partition.interiorRows(rank, halo);
+  const int localRows = interior + 2 * halo;
+  unsigned char *local = new unsigned char[localRows * rowLen];
+  const int ownedOffset = rank == 0 ? 0 : halo * rowLen;
+  double begin = MPI_Wtime();
+  MPI_Scatterv(img.data.get(), counts.data(), displs.data(),
+               MPI_UNSIGNED_CHAR, local + ownedOffset, counts[rank],
+               MPI_UNSIGNED_CHAR, ROOT, comm);
+  timings.scatterSeconds = MPI_Wtime() - begin;
+  Image stripe(local, shape.width, localRows, shape.channels);
+
+  const int up = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+  const int down = rank < size - 1 ? rank + 1 : MPI_PROC_NULL;
+  Exchange rows;
+  rows.requests.resize(4);
+  MPI_Irecv(local, halo * rowLen, MPI_UNSIGNED_CHAR, up, TAG_DOWN, comm,
+            &rows.requests[0]);
+  MPI_Irecv(local + (halo + interior) * rowLen, halo * rowLen,
+            MPI_UNSIGNED_CHAR, down, TAG_UP, comm, &rows.requests[1]);
+  // First filtered rows go up as the upper neighbour's bottom halo, the
+  // last ones down as the lower neighbour's top halo
+  MPI_Isend(local + halo * rowLen, halo * rowLen, MPI_UNSIGNED_CHAR, up,
+            TAG_UP, comm, &rows.requests[2]);
+  MPI_Isend(local + interior * rowLen, halo * rowLen, MPI_UNSIGNED_CHAR,
+            down, TAG_DOWN, comm, &rows.requests[3]);
+
+  ThreadDecision choice = rankThreads(static_cast<long>(interior) * rowLen,
+                                      kernel, comm, decision);
+  const OverlapPlan plan =
+      planOverlap(interior, shape.width - 2 * halo, halo,
+                  up != MPI_PROC_NULL, down != MPI_PROC_NULL, false, false);
+  Image filtered = filterOverlapped(stripe, plan, kernel, choice.threads,
+                                    rows, nullptr, timings);
+
+  unsigned char *output = nullptr;
+  if (rank == ROOT) {
+    output = new unsigned char[static_cast<size_t>(shape.height) * rowLen];
+  }
+  begin = MPI_Wtime();
+  MPI_Gatherv(filtered.data.get() + ownedOffset, counts[rank],
+              MPI_UNSIGNED_CHAR, output, counts.data(), displs.data(),
+              MPI_UNSIGNED_CHAR, ROOT, comm);
+  timings.gatherSeconds = MPI_Wtime() - begin;
+  reduceTimings(timings, comm, result);
+  if (rank != ROOT) {
+    return Image();
+  }
+  return Image(output, shape.width, shape.height, shape.channels);
+}
+
+Image runBlocks(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                Shape shape, ProcessGrid grid, ThreadDecision *decision,
+                DistributedTimings *result) {
+  int size;
+  MPI_Comm_size(comm, &size);
+  if (grid.rows * grid.cols != size) {
+    throw std::runtime_error(
+        "a " + std::to_string(grid.rows) + " x " + std::to_string(grid.cols) +
+        " grid does not match " + std::to_string(size) + " ranks");
+  }
+  const int halo = kernel.size() / 2;
+  const int channels = shape.channels;
+  const int rowLen = shape.width * channels;
+  const StripePartition rowParts =
+      partitionStripes(shape.height, halo, grid.rows);
+  const StripePartition colParts =
+      partitionStripes(shape.width, halo, grid.cols);
+  DistributedTimings timings;
+
+  MPI_Comm cart;
+  int dims[2] = {grid.rows, grid.cols};
+  int periods[2] = {0, 0};
+  // No reordering, so rank 0 remains the rank holding the image
+  MPI_Cart_create(comm, 2, dims, periods, 0, &cart);
+  int rank;
+  MPI_Comm_rank(cart, &rank);
+  int coords[2];
+  MPI_Cart_coords(cart, rank, 2, coords);
+  const int by = coords[0], bx = coords[1];
+  int up, down, left, right;
+  MPI_Cart_shift(cart, 0, 1, &up, &down);
+  MPI_Cart_shift(cart, 1, 1, &left, &right);
+
+  // Local block: the rows and columns filtered here with a halo all round.
+  // Blocks on the image edge receive their padding as that halo.
+  const int interiorRows = rowParts.interiorRows(by, halo);
+  const int interiorCols = colParts.interiorRows(bx, halo);
+  const int localRows = interiorRows + 2 * halo;
+  const int localCols = interiorCols + 2 * halo;
+  const int localRowLen = localCols * channels;
+  unsigned char *local = new unsigned char[localRows * localRowLen];
+  const int ownedOffset =
+      (by == 0 ? 0 : halo) * localRowLen + (bx == 0 ? 0 : halo) * channels;
+  MPI_Datatype ownedType = vectorType(
+      rowParts.rows[by], colParts.rows[bx] * channels, localRowLen);
+
+  // The root cuts every rank's block out of the image in place
+  std::vector<MPI_Datatype> rootTypes;
+  std::vector<int> rootOffsets;
+  if (rank == ROOT) {
+    for (int r = 0; r < size; r++) {
+      int c[2];
+      MPI_Cart_coords(cart, r, 2, c);
+      rootTypes.push_back(vectorType(rowParts.rows[c[0]],
+                                     colParts.rows[c[1]] * channels, rowLen));
+      rootOffsets.push_back(rowParts.first[c[0]] * rowLen +
+                            colParts.first[c[1]] * channels);
+    }
+  }
+  double begin = MPI_Wtime();
+  std::vector<MPI_Request> requests(rootTypes.size());
+  for (size_t r = 0; r < rootTypes.size(); r++) {
+    MPI_Isend(img.data.get() + rootOffsets[r], 1, rootTypes[r], r, TAG_BLOCK,
+              cart, &requests[r]);
+  }
+  MPI_Recv(local + ownedOffset, 1, ownedType, ROOT, TAG_BLOCK, cart,
+           MPI_STATUS_IGNORE);
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  timings.scatterSeconds = MPI_Wtime() - begin;
+  Image block(local, localCols, localRows, channels);
+
+  // Whole local rows first; their halo columns are still stale, but the
+  // column exchange overwrites them, corners included
+  Exchange rows;
+  rows.requests.resize(4);
+  MPI_Irecv(local, halo * localRowLen, MPI_UNSIGNED_CHAR, up, TAG_DOWN, cart,
+            &rows.requests[0]);
+  MPI_Irecv(local + (halo + interiorRows) * localRowLen, halo * localRowLen,
+            MPI_UNSIGNED_CHAR, down, TAG_UP, cart, &rows.requests[1]);
+  MPI_Isend(local + halo * localRowLen, halo * localRowLen,
+            MPI_UNSIGNED_CHAR, up, TAG_UP, cart, &rows.requests[2]);
+  MPI_Isend(local + interiorRows * localRowLen, halo * localRowLen,
+            MPI_UNSIGNED_CHAR, down, TAG_DOWN, cart, &rows.requests[3]);
+  auto postColumns = [&] {
+    MPI_Datatype columnType =
+        vectorType(localRows, halo * channels, localRowLen);
+    Exchange columns;
+    columns.requests.resize(4);
+    MPI_Irecv(local, 1, columnType, left, TAG_RIGHT, cart,
+              &columns.requests[0]);
+    MPI_Irecv(local + (halo + interiorCols) * channels, 1, columnType, right,
+              TAG_LEFT, cart, &columns.requests[1]);
+    MPI_Isend(local + halo * channels, 1, columnType, left, TAG_LEFT, cart,
+              &columns.requests[2]);
+    MPI_Isend(local + interiorCols * channels, 1, columnType, right,
+              TAG_RIGHT, cart, &columns.requests[3]);
+    // Freed once the messages using it complete
+    MPI_Type_free(&columnType);
+    return columns;
+  };
+
+  ThreadDecision choice =
+      rankThreads(static_cast<long>(interiorRows) * interiorCols * channels,
+                  kernel, cart, decision);
+  const OverlapPlan plan = planOverlap(
+      interiorRows, interiorCols, halo, up != MPI_PROC_NULL,
+      down != MPI_PROC_NULL, left != MPI_PROC_NULL, right != MPI_PROC_NULL);
+  Image filtered = filterOverlapped(block, plan, kernel, choice.threads, rows,
+                                    postColumns, timings);
+
+  unsigned char *output = nullptr;
+  if (rank == ROOT) {
+    output = new unsigned char[static_cast<size_t>(shape.height) * rowLen];
+  }
+  begin = MPI_Wtime();
+  for (size_t r = 0; r < rootTypes.size(); r++) {
+    MPI_Irecv(output + rootOffsets[r], 1, rootTypes[r], r, TAG_RESULT, cart,
+              &requests[r]);
+  }
+  MPI_Send(filtered.data.get() + ownedOffset, 1, ownedType, ROOT, TAG_RESULT,
+           cart);
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+  timings.gatherSeconds = MPI_Wtime() - begin;
+
+  MPI_Type_free(&ownedType);
+  for (MPI_Datatype &type : rootTypes) {
+    MPI_Type_free(&type);
+  }
+  reduceTimings(timings, cart, result);
+  MPI_Comm_free(&cart);
+  if (rank != ROOT) {
+    return Image();
+  }
+  return Image(output, shape.width, shape.height, shape.channels);
+}
+} // namespace
+
+int StripePartition::interiorRows(int rank, int halo) const {
+  const int last = static_cast<int>(rows.size()) - 1;
+  return rows[rank] - (rank == 0 ? halo : 0) - (rank == last ? halo : 0);
+}
+
+OverlapPlan planOverlap(int interiorRows, int interiorCols, int halo, bool up,
+                        bool down, bool left, bool right) {
+  // First and last rows and columns that read no neighbour's pixels. Every
+  // neighbour's block is at least `halo` thick, and so is this one.
+  const int top = halo + (up ? halo : 0);
+  const int bottom = std::max(top, halo + interiorRows - (down ? halo : 0));
+  const int first = halo + (left ? halo : 0);
+  const int last = std::max(first, halo + interiorCols - (right ? halo : 0));
+  OverlapPlan plan;
+  plan.interior = {top, bottom, first, last};
+  auto add = [](std::vector<BlockRect> &parts, BlockRect rect) {
+    if (rect.y0 < rect.y1 && rect.x0 < rect.x1) {
+      parts.push_back(rect);
+    }
+  };
+  add(plan.rowEdges, {halo, top, first, last});
+  add(plan.rowEdges, {bottom, halo + interiorRows, first, last});
+  add(plan.columnEdges, {halo, halo + interiorRows, halo, first});
+  add(plan.columnEdges, {halo, halo + interiorRows, last, halo + interiorCols});
+  return plan;
+}
+
+StripePartition partitionStripes(int paddedHeight, int halo, int ranks) {
+  const int interior = paddedHeight - 2 * halo;
+  if (ranks < 1 || interior < ranks * std::max(1, halo)) {
+    throw std::runtime_error(
+        std::to_string(interior) + " rows cannot be split into " +
+        std::to_string(ranks) + " stripes of at least " +
+        std::to_string(std::max(1, halo)) + " rows");
+  }
+  StripePartition partition;
+  int next = 0;
+  for (int rank = 0; rank < ranks; rank++) {
+    int rows = interior / ranks + (rank < interior % ranks);
+    rows += rank == 0 ? halo : 0;
+    rows += rank == ranks - 1 ? halo : 0;
+    partition.first.push_back(next);
+    partition.rows.push_back(rows);
+    next += rows;
+  }
+  return partition;
+}
+
+ProcessGrid chooseProcessGrid(int paddedWidth, int paddedHeight, int halo,
+                              int ranks) {
+  const int interiorWidth = paddedWidth - 2 * halo;
+  const int interiorHeight = paddedHeight - 2 * halo;
+  const int thinnest = std::max(1, halo);
+  ProcessGrid best;
+  double bestCost = -1;
+  for (int cols = 1; cols <= ranks; cols++) {
+    if (ranks % cols != 0) {
+      continue;
+    }
+    const int rows = ranks / cols;
+    if (interiorWidth < cols * thinnest || interiorHeight < rows * thinnest) {
+      continue;
+    }
+    // Halo of a block in the middle, which has the most neighbours
+    const double blockWidth = static_cast<double>(interiorWidth) / cols;
+    const double blockHeight = static_cast<double>(interiorHeight) / rows;
+    const double cost = std::min(2, rows - 1) * blockWidth +
+                        std::min(2, cols - 1) * blockHeight;
+    if (bestCost < 0 || cost < bestCost) {
+      best.rows = rows;
+      best.cols = cols;
+      bestCost = cost;
+    }
+  }
+  if (bestCost < 0) {
+    throw std::runtime_error(
+        "a " + std::to_string(interiorWidth) + " x " +
+        std::to_string(interiorHeight) + " image cannot be split into " +
+        std::to_string(ranks) + " blocks of at least " +
+        std::to_string(thinnest) + " pixels");
+  }
+  return best;
+}
+
+Image convolveStripes(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                      ThreadDecision *decision, DistributedTimings *timings) {
+  return runStripes(img, kernel, comm, broadcastShape(img, comm), decision,
+                    timings);
+}
+
+Image convolveBlocks(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                     ProcessGrid grid, ThreadDecision *decision,
+                     DistributedTimings *timings) {
+  return runBlocks(img, kernel, comm, broadcastShape(img, comm), grid,
+                   decision, timings);
+}
+
+Image convolveDistributed(const Image &img, const Kernel &kernel,
+                          MPI_Comm comm, ThreadDecision *decision,
+                          ProcessGrid *used, DistributedTimings *timings) {
+  int size;
+  MPI_Comm_size(comm, &size);
+  const Shape shape = broadcastShape(img, comm);
+  const ProcessGrid grid = chooseProcessGrid(shape.width, shape.height,
+                                             kernel.size() / 2, size);
+  if (used) {
+    *used = grid;
+  }
+  if (grid.cols == 1) {
+    return runStripes(img, kernel, comm, shape, decision, timings);
+  }
+  return runBlocks(img, kernel, comm, shape, grid, decision, timings);
+}
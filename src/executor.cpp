@@ -0,0 +1,132 @@
+#include "include/executor.h"
+#include "include/work_stealing.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#ifdef OPENMP
+#include <omp.h>
+#endif
+#ifdef PARAFILTER_PSTL
+#include <execution>
+#include <mutex>
+#include <numeric>
+#include <vector>
+#endif
+
+#ifdef PARAFILTER_PSTL
+namespace {
+// Set while the current thread runs a band, so nested parallelFor() calls
+// run inline as the contract asks
+thread_local bool inBand = false;
+} // namespace
+#endif
+
+void SequentialExecutor::parallelFor(int count, const Task &task) {
+  for (int i = 0; i < count; i++) {
+    task(i, 0);
+  }
+}
+
+#ifdef OPENMP
+OpenMpExecutor::OpenMpExecutor(int nthreads)
+    : nthreads(std::max(1, nthreads)) {}
+
+void OpenMpExecutor::parallelFor(int count, const Task &task) {
+  // An exception leaving the parallel region would terminate, so the first
+  // one is kept, the remaining iterations are skipped and it is rethrown
+  // after the join.
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (int i = 0; i < count; i++) {
+    if (failed.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    try {
+      task(i, omp_get_thread_num());
+    } catch (...) {
+#pragma omp critical(executor_error)
+      if (!error) {
+        error = std::current_exception();
+      }
+      failed = true;
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+#endif
+
+#ifdef PARAFILTER_PSTL
+ParallelStlExecutor::ParallelStlExecutor(int nthreads)
+    : nthreads(std::max(1, nthreads)) {}
+
+void ParallelStlExecutor::parallelFor(int count, const Task &task) {
+  if (count <= 0) {
+    return;
+  }
+  if (inBand) {
+    for (int i = 0; i < count; i++) {
+      task(i, 0);
+    }
+    return;
+  }
+  std::vector<int> bands(std::min(nthreads, count));
+  std::iota(bands.begin(), bands.end(), 0);
+  const int nbands = bands.size();
+  // An exception leaving the element function would terminate, so the
+  // first one is carried out by hand and stops every band at its next
+  // task. Taking a lock rules out par_unseq.
+  std::mutex mutex;
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+  std::for_each(std::execution::par, bands.begin(), bands.end(),
+                [&](int band) {
+                  const int first = static_cast<long>(count) * band / nbands;
+                  const int last =
+                      static_cast<long>(count) * (band + 1) / nbands;
+                  inBand = true;
+                  try {
+                    for (int i = first;
+                         i < last && !failed.load(std::memory_order_relaxed);
+                         i++) {
+                      task(i, band);
+                    }
+                  } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                      error = std::current_exception();
+                    }
+                    failed = true;
+                  }
+                  inBand = false;
+                });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+#endif
+
+std::unique_ptr<Executor> makeExecutor(ExecutorKind kind, int nthreads) {
+  switch (kind) {
+  case ExecutorKind::Sequential:
+    return std::make_unique<SequentialExecutor>();
+  case ExecutorKind::OpenMp:
+#ifdef OPENMP
+    return std::make_unique<OpenMpExecutor>(nthreads);
+#else
+    throw std::runtime_error("built without OpenMP support");
+#endif
+  case ExecutorKind::WorkStealing:
+    return std::make_unique<WorkStealingExecutor>(nthreads);
+  case ExecutorKind::ParallelStl:
+#ifdef PARAFILTER_PSTL
+    return std::make_unique<ParallelStlExecutor>(nthreads);
+#else
+    throw std::runtime_error("built without parallel STL (TBB) support");
+#endif
+  }
+  throw std::runtime_error("unknown executor kind");
+}
@@ -0,0 +1,184 @@
+#include "include/flat_tiles.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+namespace {
+constexpr int TILE = 64;
+// Samples used to evaluate the kernel on a flat neighbourhood; long enough
+// for the vectorised loop body, next to a single-sample (scalar) run
+constexpr int PROBE = 64;
+
+// Output of applySparseRow() for a constant neighbourhood of each value, or
+// -1 where the vectorised and scalar paths disagree
+std::array<int, 256> flatResponses(const SparseKernel &kernel) {
+  const int kHalf = kernel.size / 2;
+  const int rowLen = PROBE + 2 * kHalf;
+  std::vector<unsigned char> input(kernel.size * rowLen);
+  std::vector<const unsigned char *> rows(kernel.size);
+  for (int i = 0; i < kernel.size; i++) {
+    rows[i] = input.data() + i * rowLen;
+  }
+  std::vector<float> acc(SparseKernel::ROW_CHUNK);
+  std::vector<float> groupSum(SparseKernel::ROW_CHUNK);
+  std::vector<unsigned char> wide(rowLen), single(rowLen);
+
+  std::array<int, 256> responses;
+  for (int v = 0; v < 256; v++) {
+    std::fill(input.begin(), input.end(), static_cast<unsigned char>(v));
+    applySparseRow(kernel, rows.data(), 1, kHalf, kHalf + PROBE, acc.data(),
+                   groupSum.data(), wide.data());
+    applySparseRow(kernel, rows.data(), 1, kHalf, kHalf + 1, acc.data(),
+                   groupSum.data(), single.data());
+    const unsigned char value = wide[kHalf + PROBE / 2];
+    responses[v] = value == single[kHalf] ? value : -1;
+  }
+  return responses;
+}
+
+// True when `rows` rows of `len` samples all equal `ref`
+bool isFlatScalar(const unsigned char *p, int rowLen, int rows, int len,
+                  const unsigned char *ref) {
+  for (int i = 0; i < rows; i++) {
+    if (memcmp(p + i * rowLen, ref, len) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((target("avx2"))) bool
+isFlatAvx2(const unsigned char *p, int rowLen, int rows, int len,
+           const unsigned char *ref) {
+  for (int i = 0; i < rows; i++) {
+    const unsigned char *row = p + i * rowLen;
+    __m256i diff = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 32 <= len; j += 32) {
+      __m256i a =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + j));
+      __m256i b =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ref + j));
+      diff = _mm256_or_si256(diff, _mm256_xor_si256(a, b));
+    }
+    if (!_mm256_testz_si256(diff, diff) ||
+        memcmp(row + j, ref + j, len - j) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+Image applyKernelSparseSkipFlat(const Image &img, const SparseKernel &kernel,
+                                Executor &executor, FlatTileStats *stats) {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  const int kHalf = kernel.size / 2;
+  const unsigned char *src = img.data.get();
+
+  // Every interior sample is written below, so only the border rows are
+  // copied here; the first and last tiles of each row copy its border
+  // columns, so no interior row is first touched by the calling thread
+  unsigned char *output = new unsigned char[width * height * channels];
+  const int border = kHalf * channels;
+  memcpy(output, src, kHalf * rowLen);
+  memcpy(output + (height - kHalf) * rowLen, src + (height - kHalf) * rowLen,
+         kHalf * rowLen);
+
+  const std::array<int, 256> responses = flatResponses(kernel);
+  const int interiorRows = height - 2 * kHalf;
+  const int interiorCols = width - 2 * kHalf;
+  const int tileRows = (interiorRows + TILE - 1) / TILE;
+  const int tileCols = (interiorCols + TILE - 1) / TILE;
+  struct Scratch {
+    std::vector<float> acc, groupSum;
+    std::vector<const unsigned char *> rows;
+    std::vector<unsigned char> ref, fill;
+    long skipped = 0;
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(tileRows * tileCols, [&](int task, int worker) {
+    Scratch &s = scratch[worker];
+    if (s.rows.empty()) {
+      s.acc.resize(SparseKernel::ROW_CHUNK);
+      s.groupSum.resize(SparseKernel::ROW_CHUNK);
+      s.rows.resize(kernel.size);
+      s.ref.resize((TILE + 2 * kHalf) * channels);
+      s.fill.resize(TILE * channels);
+    }
+    const int y0 = kHalf + task / tileCols * TILE;
+    const int x0 = kHalf + task % tileCols * TILE;
+    const int y1 = std::min(y0 + TILE, height - kHalf);
+    const int x1 = std::min(x0 + TILE, width - kHalf);
+    const int begin = x0 * channels;
+    const int end = x1 * channels;
+    for (int y = y0; y < y1; y++) {
+      if (x0 == kHalf) {
+        memcpy(output + y * rowLen, src + y * rowLen, border);
+      }
+      if (x1 == width - kHalf) {
+        memcpy(output + (y + 1) * rowLen - border,
+               src + (y + 1) * rowLen - border, border);
+      }
+    }
+
+    // Tile plus halo against its first pixel repeated
+    const unsigned char *corner =
+        src + (y0 - kHalf) * rowLen + (x0 - kHalf) * channels;
+    const int haloLen = (x1 - x0 + 2 * kHalf) * channels;
+    for (int j = 0; j < haloLen; j += channels) {
+      memcpy(s.ref.data() + j, corner, channels);
+    }
+    const int haloRows = y1 - y0 + 2 * kHalf;
+    bool flat =
+        avx2 ? isFlatAvx2(corner, rowLen, haloRows, haloLen, s.ref.data())
+             : isFlatScalar(corner, rowLen, haloRows, haloLen, s.ref.data());
+    for (int c = 0; flat && c < channels; c++) {
+      const bool alpha = channels == 4 && c == 3;
+      const int response = alpha ? corner[c] : responses[corner[c]];
+      if (response < 0) {
+        flat = false;
+      }
+      for (int j = c; flat && j < end - begin; j += channels) {
+        s.fill[j] = static_cast<unsigned char>(response);
+      }
+    }
+
+    if (flat) {
+      for (int y = y0; y < y1; y++) {
+        memcpy(output + y * rowLen + begin, s.fill.data(), end - begin);
+      }
+      s.skipped++;
+      return;
+    }
+    for (int y = y0; y < y1; y++) {
+      for (int ky = 0; ky < kernel.size; ky++) {
+        s.rows[ky] = src + (y + ky - kHalf) * rowLen;
+      }
+      applySparseRow(kernel, s.rows.data(), channels, begin, end,
+                     s.acc.data(), s.groupSum.data(), output + y * rowLen);
+    }
+  });
+
+  if (stats) {
+    stats->skipped = 0;
+    for (const Scratch &s : scratch) {
+      stats->skipped += s.skipped;
+    }
+    stats->total = static_cast<long>(tileRows) * tileCols;
+  }
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelSparseSkipFlat(const Image &img, const SparseKernel &kernel,
+                                int nthreads, FlatTileStats *stats) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelSparseSkipFlat(img, kernel, executor, stats);
+}
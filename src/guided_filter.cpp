@@ -0,0 +1,202 @@
+#include "include/guided_filter.h"
+#include "include/float_image.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+// Rows handled by one task. Each task first sums the 2 * radius + 1 rows
+// around its first row, so strips are kept well above that.
+constexpr int STRIP_ROWS = 64;
+
+// Cropped box window over rows of `channels` interleaved samples per pixel
+struct BoxWindow {
+  int width, height, channels, radius;
+  // 1 / horizontal window size for every sample of a row
+  std::vector<float> invRow;
+  // 1 / vertical window size for every row
+  std::vector<float> invY;
+
+  BoxWindow(int width, int height, int channels, int radius)
+      : width(width), height(height), channels(channels), radius(radius),
+        invRow(static_cast<size_t>(width) * channels), invY(height) {
+    for (int x = 0; x < width; x++) {
+      int count = std::min(x + radius, width - 1) - std::max(x - radius, 0) + 1;
+      std::fill_n(invRow.begin() + x * channels, channels, 1.0f / count);
+    }
+    for (int y = 0; y < height; y++) {
+      int count =
+          std::min(y + radius, height - 1) - std::max(y - radius, 0) + 1;
+      invY[y] = 1.0f / count;
+    }
+  }
+
+  int rowLen() const { return width * channels; }
+};
+
+// Window sums along one row, cropped at the borders
+void rowSums(const BoxWindow &window, const float *in, float *out) {
+  const int width = window.width;
+  const int channels = window.channels;
+  const int radius = window.radius;
+  for (int c = 0; c < channels; c++) {
+    float sum = 0.0f;
+    for (int x = 0; x <= std::min(radius, width - 1); x++) {
+      sum += in[x * channels + c];
+    }
+    for (int x = 0; x < width; x++) {
+      out[x * channels + c] = sum;
+      if (x + radius + 1 < width) {
+        sum += in[(x + radius + 1) * channels + c];
+      }
+      if (x - radius >= 0) {
+        sum -= in[(x - radius) * channels + c];
+      }
+    }
+  }
+}
+
+/*
+ * Calls body(y, mean) for the rows [y0, y1) with the box means of the rows
+ * returned by load(y, line), which may fill `line` or point elsewhere. Only
+ * running column sums are kept, so a source row is loaded and summed when it
+ * enters the window and again when it leaves it instead of being stored.
+ */
+template <typename Load, typename Body>
+void boxMeanRows(const BoxWindow &window, int y0, int y1,
+                 std::vector<float> &scratch, Load load, Body body) {
+  const int len = window.rowLen();
+  if (scratch.size() < static_cast<size_t>(4) * len) {
+    scratch.resize(static_cast<size_t>(4) * len);
+  }
+  float *line = scratch.data();
+  float *sums = line + len;
+  float *acc = sums + len;
+  float *mean = acc + len;
+  auto slide = [&](int y, float sign) {
+    rowSums(window, load(y, line), sums);
+#pragma omp simd
+    for (int j = 0; j < len; j++) {
+      acc[j] += sign * sums[j];
+    }
+  };
+
+  const int radius = window.radius;
+  const int height = window.height;
+  const float *inv = window.invRow.data();
+  std::fill(acc, acc + len, 0.0f);
+  for (int y = std::max(y0 - radius, 0);
+       y <= std::min(y0 + radius, height - 1); y++) {
+    slide(y, 1.0f);
+  }
+  for (int y = y0; y < y1; y++) {
+    const float scale = window.invY[y];
+#pragma omp simd
+    for (int j = 0; j < len; j++) {
+      mean[j] = acc[j] * inv[j] * scale;
+    }
+    body(y, static_cast<const float *>(mean));
+    if (y + 1 < y1) {
+      if (y + radius + 1 < height) {
+        slide(y + radius + 1, 1.0f);
+      }
+      if (y - radius >= 0) {
+        slide(y - radius, -1.0f);
+      }
+    }
+  }
+}
+} // namespace
+
+Image guidedFilter(const Image &guide, const Image &input, int radius,
+                   float epsilon, Executor &executor) {
+  if (guide.width != input.width || guide.height != input.height) {
+    throw std::runtime_error("guide and input sizes differ");
+  }
+  if (guide.channels != 1 && guide.channels != input.channels) {
+    throw std::runtime_error("guide must have 1 channel or match the input");
+  }
+  const int width = input.width;
+  const int height = input.height;
+  const int channels = input.channels;
+  const int guideChannels = guide.channels;
+  const float norm = 1.0f / 255.0f;
+  const int stripRows = std::max(STRIP_ROWS, 4 * radius);
+  const int strips = (height + stripRows - 1) / stripRows;
+  std::vector<std::vector<float>> scratch(executor.workers());
+
+  // The first pass statistics (I, p, I*p, I*I) are interleaved so one set of
+  // running sums yields their means together. They are rebuilt from the 8 bit
+  // images whenever a row enters or leaves the window rather than stored, and
+  // only the per-window linear coefficients (a, b) are kept for the image.
+  FloatImage coeffs(width, height, 2 * channels);
+  BoxWindow statsWindow(width, height, 4 * channels, radius);
+  executor.parallelFor(strips, [&](int s, int worker) {
+    auto load = [&](int y, float *line) {
+      const unsigned char *g =
+          guide.data.get() + static_cast<size_t>(y) * width * guideChannels;
+      const unsigned char *p =
+          input.data.get() + static_cast<size_t>(y) * width * channels;
+      for (int x = 0; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+          float vi = g[x * guideChannels + (guideChannels == 1 ? 0 : c)] * norm;
+          float vp = p[x * channels + c] * norm;
+          float *st = line + (x * channels + c) * 4;
+          st[0] = vi;
+          st[1] = vp;
+          st[2] = vi * vp;
+          st[3] = vi * vi;
+        }
+      }
+      return static_cast<const float *>(line);
+    };
+    auto body = [&](int y, const float *m) {
+      float *out = coeffs.row(y);
+      for (int i = 0; i < width * channels; i++) {
+        float meanI = m[4 * i];
+        float meanP = m[4 * i + 1];
+        float cov = m[4 * i + 2] - meanI * meanP;
+        float var = m[4 * i + 3] - meanI * meanI;
+        float a = cov / (var + epsilon);
+        out[2 * i] = a;
+        out[2 * i + 1] = meanP - a * meanI;
+      }
+    };
+    int y0 = s * stripRows;
+    boxMeanRows(statsWindow, y0, std::min(y0 + stripRows, height),
+                scratch[worker], load, body);
+  });
+
+  unsigned char *output = new unsigned char[width * height * channels];
+  BoxWindow coeffsWindow(width, height, 2 * channels, radius);
+  executor.parallelFor(strips, [&](int s, int worker) {
+    auto load = [&](int y, float *) {
+      return static_cast<const float *>(coeffs.row(y));
+    };
+    auto body = [&](int y, const float *m) {
+      const unsigned char *g =
+          guide.data.get() + static_cast<size_t>(y) * width * guideChannels;
+      unsigned char *out = output + static_cast<size_t>(y) * width * channels;
+      for (int x = 0; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+          int i = x * channels + c;
+          float vi = g[x * guideChannels + (guideChannels == 1 ? 0 : c)] * norm;
+          float q = (m[2 * i] * vi + m[2 * i + 1]) * 255.0f;
+          out[i] = static_cast<unsigned char>(
+              std::min(std::max(q, 0.0f), 255.0f) + 0.5f);
+        }
+      }
+    };
+    int y0 = s * stripRows;
+    boxMeanRows(coeffsWindow, y0, std::min(y0 + stripRows, height),
+                scratch[worker], load, body);
+  });
+  return Image(output, width, height, channels);
+}
+
+Image guidedFilter(const Image &guide, const Image &input, int radius,
+                   float epsilon, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return guidedFilter(guide, input, radius, epsilon, executor);
+}
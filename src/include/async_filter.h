@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "convolution.h"
+#include "executor.h"
+#include "image.h"
+#include "thread_pool.h"
+#include "unsharp_mask.h"
+
+using Deadline = std::chrono::steady_clock::time_point;
+/// Deadline of requests that may take as long as they need
+constexpr Deadline NO_DEADLINE = Deadline::max();
+
+/**
+ * @brief Thrown by a request that was cancelled or ran out of time.
+ */
+class FilterCancelled : public std::runtime_error {
+public:
+  enum class Reason { Cancelled, DeadlineExceeded };
+
+  explicit FilterCancelled(Reason reason);
+  Reason reason() const { return why; }
+
+private:
+  Reason why;
+};
+
+/**
+ * @brief Shared flag a caller sets to abandon one or more requests. Copies
+ * share the flag.
+ */
+class CancellationToken {
+public:
+  CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+  void cancel() const { flag->store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+  std::shared_ptr<std::atomic<bool>> flag;
+};
+
+/**
+ * @brief Executor that checks a token and a deadline before every task of
+ * the wrapped executor and throws FilterCancelled once either fired.
+ *
+ * Filters split their work into row or tile tasks, so an abandoned filter
+ * stops within one task per worker: every executor skips its remaining
+ * tasks after the first exception (see Executor::parallelFor()).
+ */
+class CancellableExecutor : public Executor {
+public:
+  CancellableExecutor(Executor &inner, CancellationToken token,
+                      Deadline deadline = NO_DEADLINE);
+
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return inner.workers(); }
+  const char *name() const override { return inner.name(); }
+
+  /**
+   * @brief Throws FilterCancelled when the request should stop.
+   */
+  void check() const;
+
+private:
+  Executor &inner;
+  CancellationToken token;
+  Deadline deadline;
+};
+
+/**
+ * @brief Non-blocking filter calls for services.
+ *
+ * Requests are queued and run one at a time, in order, each split over the
+ * filter's pinned ThreadPool, so every request gets all the cores and
+ * finishes as early as the queue allows. Each call returns a future of the
+ * filtered image that rethrows whatever the filter threw: FilterCancelled
+ * when its token was cancelled or its deadline passed, checked before the
+ * request starts and before every row or tile task. Destroying the filter
+ * waits for the running request and fails the queued ones with
+ * FilterCancelled.
+ */
+class AsyncFilter {
+public:
+  using Work = std::function<Image(Executor &executor)>;
+
+  explicit AsyncFilter(int nthreads);
+  ~AsyncFilter();
+
+  AsyncFilter(const AsyncFilter &) = delete;
+  AsyncFilter &operator=(const AsyncFilter &) = delete;
+
+  /**
+   * @brief Runs work on a CancellableExecutor over the pool.
+   */
+  std::future<Image> submit(Work work,
+                            CancellationToken token = CancellationToken(),
+                            Deadline deadline = NO_DEADLINE);
+
+  /**
+   * @brief Asynchronous applyKernelOpenMp / convolve(): img must be padded
+   * by kernel.size() / 2; it is moved into the request.
+   */
+  std::future<Image>
+  applyKernel(Image img, const Kernel &kernel,
+              CancellationToken token = CancellationToken(),
+              Deadline deadline = NO_DEADLINE,
+              const ConvolutionOptions &options = ConvolutionOptions());
+
+  std::future<Image>
+  unsharpMask(Image img, const UnsharpMaskParams &params,
+              CancellationToken token = CancellationToken(),
+              Deadline deadline = NO_DEADLINE);
+
+  int threads() const { return pool.workers(); }
+
+private:
+  struct Request {
+    Work work;
+    CancellationToken token;
+    Deadline deadline;
+    std::promise<Image> result;
+  };
+
+  void dispatch();
+
+  ThreadPool pool;
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::deque<Request> requests;
+  bool stopping = false;
+  std::thread dispatcher;
+};
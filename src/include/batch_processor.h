@@ -0,0 +1,123 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief One image of a batch: its decoded size, known before decoding, and
+ * how to decode it.
+ */
+struct BatchItem {
+  size_t bytes = 0;
+  std::function<Image()> load;
+};
+
+/**
+ * @brief Item that decodes an image file with stb_image. The size comes from
+ * the file header; throws std::runtime_error when it cannot be read.
+ */
+BatchItem fileItem(const std::string &path);
+
+/**
+ * @brief Admission counters of the last BatchProcessor::process() call.
+ */
+struct BatchStats {
+  int images = 0;          ///< Items processed.
+  int peakInFlight = 0;    ///< Most images admitted at the same time.
+  size_t peakBytes = 0;    ///< Largest admitted footprint at the same time.
+  int waits = 0;           ///< Admissions that waited for memory.
+};
+
+/**
+ * @brief Runs a batch of images concurrently on one set of workers, which
+ * also run the row and tile tasks of the filters applied to them.
+ *
+ * Each image is a job that decodes it, filters it and hands the result to a
+ * sink. The filter receives the processor as its Executor, so its
+ * parallelFor() calls are queued next to the other images' jobs instead of
+ * running inline: a large image is split across every idle worker while
+ * small ones each keep a single worker busy. Idle workers take the oldest
+ * image's tasks first, which keeps a large image's latency close to running
+ * it alone, and go on to the next images only when it has no task left. A
+ * worker waiting for a nested parallelFor() runs that call's tasks, or those
+ * of calls it is not itself inside, so it never reuses the scratch of a
+ * task it interrupted.
+ *
+ * Admission control caps the decoded images in flight: an image is only
+ * decoded once its bytes times FOOTPRINT_FACTOR fit in the memory budget
+ * beside the images still being processed. An image larger than the whole
+ * budget is admitted alone.
+ *
+ * Tasks get worker indices in [0, workers()) as usual. A parallelFor()
+ * from a thread outside the processor waits without helping.
+ */
+class BatchProcessor : public Executor {
+public:
+  /// Decoded input, padded copy and output of an image live at the same time
+  static constexpr double FOOTPRINT_FACTOR = 3;
+  /// Tasks are claimed in chunks, about this many per worker and call
+  static constexpr int CHUNKS_PER_WORKER = 4;
+
+  using Filter = std::function<Image(Image &img, Executor &executor)>;
+  using Sink = std::function<void(size_t index, Image &result)>;
+
+  BatchProcessor(int nthreads, size_t memoryBudget);
+  ~BatchProcessor() override;
+
+  BatchProcessor(const BatchProcessor &) = delete;
+  BatchProcessor &operator=(const BatchProcessor &) = delete;
+
+  /**
+   * @brief Decodes, filters and sinks every item, admitting them in order,
+   * and returns once all of them are done. The sink runs on a worker, once
+   * per item, in no particular order. The first exception thrown by a load,
+   * filter or sink stops further admissions and is rethrown here after the
+   * images in flight finished. Calls from several threads run one at a time.
+   */
+  void process(const std::vector<BatchItem> &items, const Filter &filter,
+               const Sink &sink);
+
+  BatchStats stats() const;
+
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return threads.size(); }
+  const char *name() const override { return "batch"; }
+
+private:
+  struct Call;
+
+  std::shared_ptr<Call> submit(int count, const Task &task, size_t sequence);
+  bool runChunk(std::unique_lock<std::mutex> &lock, const Call *awaited);
+  void workerLoop(int worker);
+  bool admit(size_t bytes);
+  void release(size_t bytes);
+
+  std::vector<std::thread> threads;
+
+  // Calls with unclaimed tasks, oldest first, and the scheduler state
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<std::shared_ptr<Call>> calls;
+  bool stopping = false;
+
+  // Serializes process() callers
+  std::mutex processMutex;
+
+  // Admission state of the current process() call
+  mutable std::mutex admissionMutex;
+  std::condition_variable released;
+  size_t budget;
+  size_t bytesInFlight = 0;
+  int imagesInFlight = 0;
+  bool failed = false;
+  std::exception_ptr error;
+  BatchStats current;
+};
@@ -0,0 +1,14 @@
+#pragma once
+#include "executor.h"
+#include "float_image.h"
+
+/**
+ * @brief Mean over a (2 * radius + 1)^2 window for every sample of every
+ * channel, with windows cropped at the image border.
+ *
+ * Uses running sums in both directions, so the cost per sample does not
+ * depend on the radius. Rows are processed in parallel in the horizontal
+ * pass and column strips in the vertical pass.
+ */
+FloatImage boxMean(const FloatImage &img, int radius, Executor &executor);
+FloatImage boxMean(const FloatImage &img, int radius, int nthreads);
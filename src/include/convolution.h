@@ -0,0 +1,73 @@
+#pragma once
+#include "image.h"
+#include "executor.h"
+#include "flat_tiles.h"
+#include "image_processing.h"
+#include "kernel_decomposition.h"
+
+/**
+ * @enum ConvolutionBackend
+ * @brief Implementations the convolution engine can dispatch a kernel to.
+ */
+enum class ConvolutionBackend {
+  Auto = 0,     ///< Pick the fastest backend for the kernel and image.
+  Direct = 1,   ///< Dense per-pixel loop (applyKernelDirect).
+  Winograd = 2, ///< Winograd F(2x2, 3x3), 3x3 kernels; never chosen by Auto.
+  Sparse = 3,   ///< Zero taps dropped, equal coefficients grouped.
+  LowRank = 4,  ///< Sum of separable passes from the kernel's SVD.
+  Jit = 5,      ///< AVX2 row routine generated for the coefficients.
+  Lut = 6       ///< Per-tap 256-entry fixed point tables, integer adds.
+};
+
+const char *backendName(ConvolutionBackend backend);
+
+/**
+ * @brief Tuning knobs of convolve().
+ */
+struct ConvolutionOptions {
+  ConvolutionBackend backend = ConvolutionBackend::Auto;
+  /// Largest Frobenius norm of (kernel - approximation) accepted by the
+  /// LowRank backend when choosing how many separable terms to run.
+  float lowRankTolerance = 1e-4f;
+  /// How the LowRank backend runs its vertical passes.
+  ColumnPass columnPass = ColumnPass::Auto;
+  /// Times the kernel is applied, each pass to the previous output with the
+  /// padding ring held fixed. Auto and Sparse run the passes temporally
+  /// blocked (applyKernelIterated); other backends run them one by one.
+  int iterations = 1;
+  /// When the Sparse backend runs, asked for or picked by Auto, fill
+  /// constant tiles without convolving them (applyKernelSparseSkipFlat).
+  /// Ignored by the other backends and when iterations > 1.
+  bool skipFlatTiles = false;
+  /// If not null, receives the tile counts when skipFlatTiles is used.
+  FlatTileStats *flatTileStats = nullptr;
+};
+
+/**
+ * @brief Backend convolve() runs for this image and kernel when the options
+ * ask for ConvolutionBackend::Auto. Winograd is only run when requested
+ * explicitly.
+ */
+ConvolutionBackend
+selectBackend(const Image &img, const Kernel &kernel,
+              const ConvolutionOptions &options = ConvolutionOptions());
+
+/**
+ * @brief The dense loop of applyKernelOpenMp, run on an executor.
+ */
+Image applyKernelDirect(const Image &img, const Kernel &kernel,
+                        Executor &executor);
+
+/**
+ * @brief Convolution engine entry point. Same contract as applyKernelOpenMp:
+ * the image must be padded by kernel.size() / 2 and the border is copied.
+ * Every backend runs its row or tile tasks on the given executor.
+ */
+Image convolve(Image &img, const Kernel &kernel, Executor &executor,
+               const ConvolutionOptions &options = ConvolutionOptions());
+
+/**
+ * @brief convolve() on ProcessingContext::shared(nthreads).
+ */
+Image convolve(Image &img, const Kernel &kernel, int nthreads,
+               const ConvolutionOptions &options = ConvolutionOptions());
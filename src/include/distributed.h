@@ -0,0 +1,153 @@
+#pragma once
+// Only the C API is used: skip the C++ bindings, which would need
+// libmpi_cxx in every target linking this file
+#ifndef OMPI_SKIP_MPICXX
+#define OMPI_SKIP_MPICXX 1
+#endif
+#ifndef MPICH_SKIP_MPICXX
+#define MPICH_SKIP_MPICXX 1
+#endif
+#include <mpi.h>
+#include <vector>
+#include "image.h"
+#include "image_processing.h"
+#include "thread_policy.h"
+
+/**
+ * @brief Rows of a padded image owned by each rank of a stripe
+ * decomposition. Every row is owned by exactly one rank.
+ */
+struct StripePartition {
+  std::vector<int> rows;  ///< Rows owned by each rank.
+  std::vector<int> first; ///< First owned row of each rank.
+
+  /**
+   * @brief Owned rows of `rank` that it filters, i.e. without the padding
+   * rows the first and last ranks also own.
+   */
+  int interiorRows(int rank, int halo) const;
+};
+
+/**
+ * @brief Splits the rows of an image padded by `halo` into `ranks`
+ * contiguous, non-overlapping stripes. The interior rows are shared out
+ * evenly, the first height % ranks stripes taking one extra row; the first
+ * rank also owns the top padding rows and the last rank the bottom ones.
+ * Throws std::runtime_error when a stripe would be thinner than the halo,
+ * whose rows would then have to come from beyond the neighbouring ranks.
+ */
+StripePartition partitionStripes(int paddedHeight, int halo, int ranks);
+
+/**
+ * @brief Shape of the process grid an image is split over: `rows` blocks
+ * down, `cols` blocks across. One column means row stripes.
+ */
+struct ProcessGrid {
+  int rows = 1;
+  int cols = 1;
+};
+
+/**
+ * @brief Grid of `ranks` blocks with the least halo data per rank.
+ *
+ * A rank with a neighbour on each side exchanges halo rows as wide as its
+ * block and halo columns as tall: stripes keep the image width however many
+ * ranks there are, while square-ish blocks shrink both sides. Among the
+ * factorizations whose blocks are at least `halo` thick, the one with the
+ * smallest halo perimeter wins, stripes on ties since their rows are
+ * contiguous. Throws std::runtime_error when no factorization fits.
+ */
+ProcessGrid chooseProcessGrid(int paddedWidth, int paddedHeight, int halo,
+                              int ranks);
+
+/**
+ * @brief Output rows [y0, y1) and columns [x0, x1) of a local block, in
+ * the block's coordinates: the owned pixels start at (halo, halo).
+ */
+struct BlockRect {
+  int y0, y1, x0, x1;
+};
+
+/**
+ * @brief Parts of a local block in the order its halos allow filtering
+ * them. Together they cover the owned pixels exactly once.
+ */
+struct OverlapPlan {
+  /// Reads no halo: filtered while the halos are in flight.
+  BlockRect interior;
+  /// Next to the halo rows from the upper and lower neighbours.
+  std::vector<BlockRect> rowEdges;
+  /// Next to the halo columns from the left and right neighbours, over the
+  /// full height since their corners also come from the rows.
+  std::vector<BlockRect> columnEdges;
+};
+
+/**
+ * @brief Splits a block of interiorRows x interiorCols owned pixels, which
+ * has a neighbour on the sides flagged, into an OverlapPlan. Sides without
+ * a neighbour are image padding the block already owns. Empty parts are
+ * left out.
+ */
+OverlapPlan planOverlap(int interiorRows, int interiorCols, int halo, bool up,
+                        bool down, bool left, bool right);
+
+/**
+ * @brief Seconds spent in the phases of a distributed filter: on rank 0 the
+ * slowest rank's time for every phase, on the others their own.
+ */
+struct DistributedTimings {
+  double scatterSeconds = 0;    ///< Handing the blocks out from rank 0.
+  double overlappedSeconds = 0; ///< Filtering while halos were in flight.
+  double haloSeconds = 0;       ///< Halos from posting to seen complete.
+  double haloWaitSeconds = 0;   ///< Blocked on halos with nothing to filter.
+  double boundarySeconds = 0;   ///< Filtering after the last halo arrived.
+  double gatherSeconds = 0;     ///< Collecting the results on rank 0.
+
+  /**
+   * @brief Halo time filtering covered. Completion is only noticed between
+   * bands of rows, so this is an upper bound.
+   */
+  double hiddenSeconds() const { return haloSeconds - haloWaitSeconds; }
+};
+
+/**
+ * @brief convolve() of an image split over the ranks of comm in row stripes.
+ *
+ * Rank 0 passes the image padded by kernel.size() / 2, the others an empty
+ * image. The stripes are distributed with MPI_Scatterv and collected with
+ * MPI_Gatherv, so rank 0 gets exactly the single-process result and the
+ * others an empty image. Halo rows are swapped with MPI_Isend / MPI_Irecv
+ * and each rank filters the rows that need none of them, following
+ * planOverlap(), before waiting for them. Every rank picks its threads
+ * with chooseThreadCount() for its stripe and its share of the node's
+ * cores; `decision` receives that choice and `timings` the phase times.
+ */
+Image convolveStripes(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                      ThreadDecision *decision = nullptr,
+                      DistributedTimings *timings = nullptr);
+
+/**
+ * @brief convolveStripes() over a 2D grid of blocks.
+ *
+ * The ranks form an MPI_Cart_create grid of grid.rows x grid.cols; rows and
+ * columns are both split by partitionStripes(). Rank 0 sends every block
+ * and receives it back through MPI_Type_vector types, so blocks are never
+ * packed by hand. Halos travel in two phases: whole local rows up and down,
+ * then halo columns, as MPI_Type_vector, left and right over the full local
+ * height, which carries the corners received in the first phase along to
+ * the diagonal neighbours. The interior is filtered during the first phase
+ * and the row edges during the second.
+ */
+Image convolveBlocks(const Image &img, const Kernel &kernel, MPI_Comm comm,
+                     ProcessGrid grid, ThreadDecision *decision = nullptr,
+                     DistributedTimings *timings = nullptr);
+
+/**
+ * @brief convolveStripes() or convolveBlocks(), whichever
+ * chooseProcessGrid() prefers for the image and the size of comm; `used`
+ * receives the grid.
+ */
+Image convolveDistributed(const Image &img, const Kernel &kernel,
+                          MPI_Comm comm, ThreadDecision *decision = nullptr,
+                          ProcessGrid *used = nullptr,
+                          DistributedTimings *timings = nullptr);
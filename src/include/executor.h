@@ -0,0 +1,92 @@
+#pragma once
+#include <functional>
+#include <memory>
+
+/**
+ * @brief Runs the independent tasks of a filter on a set of workers.
+ *
+ * Backends describe their parallel loop as `count` tasks and keep scratch
+ * per worker: the worker argument lies in [0, workers()) and no two tasks
+ * run concurrently with the same worker index. A parallelFor() issued from
+ * inside a task runs on that task's thread, as worker 0 of the inner call,
+ * except on BatchProcessor, which spreads it over its idle workers.
+ */
+class Executor {
+public:
+  using Task = std::function<void(int task, int worker)>;
+
+  virtual ~Executor() = default;
+
+  /**
+   * @brief Runs task(i, worker) for every i in [0, count) and returns once
+   * all of them have finished.
+   *
+   * When a task throws, the tasks not started yet are skipped and the first
+   * exception is rethrown on the calling thread after the running ones end.
+   */
+  virtual void parallelFor(int count, const Task &task) = 0;
+  virtual int workers() const = 0;
+  virtual const char *name() const = 0;
+};
+
+/**
+ * @brief Runs every task on the calling thread, in order.
+ */
+class SequentialExecutor : public Executor {
+public:
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return 1; }
+  const char *name() const override { return "sequential"; }
+};
+
+#ifdef OPENMP
+/**
+ * @brief Forks an OpenMP parallel region with a static schedule per call.
+ */
+class OpenMpExecutor : public Executor {
+public:
+  explicit OpenMpExecutor(int nthreads);
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return nthreads; }
+  const char *name() const override { return "openmp"; }
+
+private:
+  int nthreads;
+};
+#endif
+
+#ifdef PARAFILTER_PSTL
+/**
+ * @brief C++17 parallel algorithms: std::for_each(std::execution::par) over
+ * nthreads contiguous bands of the tasks, band b running as worker b. The
+ * standard library backend (TBB for libstdc++) decides how many bands run
+ * at once, so the build needs no OpenMP.
+ */
+class ParallelStlExecutor : public Executor {
+public:
+  explicit ParallelStlExecutor(int nthreads);
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return nthreads; }
+  const char *name() const override { return "pstl"; }
+
+private:
+  int nthreads;
+};
+#endif
+
+/**
+ * @enum ExecutorKind
+ * @brief Executors makeExecutor() can build.
+ */
+enum class ExecutorKind {
+  Sequential = 0,
+  OpenMp = 1, ///< Only when built with OpenMP (OPENMP).
+  WorkStealing = 2,
+  ParallelStl = 3 ///< Only when built with TBB (PARAFILTER_PSTL).
+};
+
+/**
+ * @brief Builds an executor of the given kind with nthreads workers.
+ * Throws std::runtime_error for kinds this build does not include.
+ */
+std::unique_ptr<Executor> makeExecutor(ExecutorKind kind, int nthreads);
@@ -0,0 +1,31 @@
+#pragma once
+#include "image.h"
+#include "sparse_kernel.h"
+
+/**
+ * @brief How many tiles applyKernelSparseSkipFlat() filled without
+ * convolving them, out of how many it looked at.
+ */
+struct FlatTileStats {
+  long skipped = 0;
+  long total = 0;
+};
+
+/**
+ * @brief applyKernelSparse() that fills constant regions directly.
+ *
+ * Each 64x64 pixel tile is first checked, with SIMD compares against its
+ * first pixel, for being constant over the tile and its kernel halo. Such a
+ * tile is filled with the value the sparse row code produces for a constant
+ * neighbourhood, looked up in a 256-entry table built per call, so the
+ * output is byte-identical to applyKernelSparse() (a normalized kernel
+ * need not return v exactly once truncated). Same contract as
+ * applyKernelOpenMp: the image must be padded by size / 2.
+ *
+ * @param stats If not null, receives the skipped and total tile counts.
+ */
+Image applyKernelSparseSkipFlat(const Image &img, const SparseKernel &kernel,
+                                Executor &executor,
+                                FlatTileStats *stats = nullptr);
+Image applyKernelSparseSkipFlat(const Image &img, const SparseKernel &kernel,
+                                int nthreads, FlatTileStats *stats = nullptr);
@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "image.h"
+
+/**
+ * @brief Interleaved floating point image used for signed or intermediate
+ * results (pyramid levels, filter statistics) that do not fit in 8 bits.
+ */
+struct FloatImage {
+  int width, height, channels;
+  std::vector<float> data;
+
+  FloatImage() : width(0), height(0), channels(0) {}
+
+  FloatImage(int width, int height, int channels)
+      : width(width), height(height), channels(channels),
+        data(static_cast<size_t>(width) * height * channels, 0.0f) {}
+
+  float *row(int y) {
+    return data.data() + static_cast<size_t>(y) * width * channels;
+  }
+  const float *row(int y) const {
+    return data.data() + static_cast<size_t>(y) * width * channels;
+  }
+
+  static FloatImage fromImage(const Image &img) {
+    FloatImage result(img.width, img.height, img.channels);
+    const unsigned char *src = img.data.get();
+    for (size_t i = 0; i < result.data.size(); i++) {
+      result.data[i] = src[i];
+    }
+    return result;
+  }
+
+  /**
+   * @brief Rounds and saturates the samples back to an 8 bit image.
+   */
+  Image toImage() const {
+    unsigned char *output = new unsigned char[data.size()];
+    for (size_t i = 0; i < data.size(); i++) {
+      output[i] = static_cast<unsigned char>(
+          std::min(std::max(data[i], 0.0f), 255.0f) + 0.5f);
+    }
+    return Image(output, width, height, channels);
+  }
+};
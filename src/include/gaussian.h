@@ -0,0 +1,28 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Radius (in pixels) of the Gaussian taps kept for a given sigma.
+ */
+inline int gaussianRadius(float sigma) {
+  return std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+}
+
+/**
+ * @brief Builds normalized 1D Gaussian taps of length 2 * radius + 1.
+ */
+inline std::vector<float> gaussianKernel1D(float sigma) {
+  int radius = gaussianRadius(sigma);
+  std::vector<float> taps(2 * radius + 1);
+  float sum = 0.0f;
+  for (int i = -radius; i <= radius; i++) {
+    taps[i + radius] = std::exp(-(i * i) / (2.0f * sigma * sigma));
+    sum += taps[i + radius];
+  }
+  for (auto &t : taps) {
+    t /= sum;
+  }
+  return taps;
+}
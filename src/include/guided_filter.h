@@ -0,0 +1,21 @@
+#pragma once
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief Edge-preserving guided filter (He et al.), q = mean(a) * I + mean(b).
+ *
+ * Every statistic is a box mean, so the cost does not depend on the radius.
+ * The means are taken with running column sums over strips of rows, so only
+ * the coefficients (two floats per sample) are held for the whole image.
+ * The guide must have the size of the input and either one channel, which
+ * then guides every input channel, or as many channels as the input, in
+ * which case each channel is guided by its counterpart.
+ *
+ * @param epsilon Regularization on intensities normalized to [0, 1]; larger
+ * values smooth more across weak edges.
+ */
+Image guidedFilter(const Image &guide, const Image &input, int radius,
+                   float epsilon, Executor &executor);
+Image guidedFilter(const Image &guide, const Image &input, int radius,
+                   float epsilon, int nthreads);
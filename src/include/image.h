@@ -18,6 +18,14 @@ struct Image {
       : width(width), height(height), channels(channels),
         data(data, image_data_deleter) {}
 
+  /**
+   * @brief Takes ownership of a buffer released with `deleter`.
+   */
+  Image(unsigned char *data, int width, int height, int channels,
+        decltype(&image_data_deleter) deleter)
+      : width(width), height(height), channels(channels),
+        data(data, deleter) {}
+
   static Image load(const char *filename) {
     int width, height, channels;
     unsigned char *raw_data =
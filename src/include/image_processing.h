@@ -1,24 +1,15 @@
 #pragma once
 #include <map>
 #include <vector>
+#ifdef OPENMP
 #include <omp.h>
+#endif
 #include "image.h"
 #include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <array>
 
-// /**
-//  * @enum Filter
-//  * @brief Enum class to maintain a strong type for different types of filters.
-//  */
-// enum class Filter {
-//   LowPass3x3 = 0,  ///< Low pass filter with a 3x3 kernel.
-//   LowPass5x5 = 1,  ///< Low pass filter with a 5x5 kernel.
-//   HighPass3x3 = 2, ///< High pass filter with a 3x3 kernel.
-//   Gaussian = 3     ///< Gaussian blur filter.
-// };
-
 template <typename T> T clamp(T value, T min, T max) {
   if (value < min) {
     return min;
@@ -57,6 +48,39 @@ constexpr inline std::array<std::array<float, 5>, 5> LowPass5x5() {
 } // namespace Filter
 } // namespace Kernels
 
+/**
+ * @brief Runtime kernel representation used by the CLI and custom kernels.
+ */
+using Kernel = std::vector<std::vector<float>>;
+
+/**
+ * @enum Filter
+ * @brief Enum class to maintain a strong type for different types of filters.
+ */
+enum class Filter {
+  LowPass3x3 = 0,  ///< Low pass filter with a 3x3 kernel.
+  LowPass5x5 = 1,  ///< Low pass filter with a 5x5 kernel.
+  HighPass3x3 = 2, ///< High pass filter with a 3x3 kernel.
+  Gaussian = 3     ///< Gaussian blur filter.
+};
+
+template <size_t N>
+Kernel toKernel(const std::array<std::array<float, N>, N> &kernel) {
+  Kernel result(N, std::vector<float>(N));
+  for (size_t i = 0; i < N; i++) {
+    for (size_t j = 0; j < N; j++) {
+      result[i][j] = kernel[i][j];
+    }
+  }
+  return result;
+}
+
+inline std::map<Filter, Kernel> kernels = {
+    {Filter::LowPass3x3, toKernel(Kernels::Filter::LowPass3x3())},
+    {Filter::LowPass5x5, toKernel(Kernels::Filter::LowPass5x5())},
+    {Filter::HighPass3x3, toKernel(Kernels::Filter::HighPass3x3())},
+    {Filter::Gaussian, toKernel(Kernels::Filter::Gaussian())}};
+
 /**
  * @brief Applies a convolution kernel to an input image to produce an output image but uses OpenMP.
  */
@@ -107,7 +131,12 @@ Image applyKernelSeq(Image &img, const Kernel kernel) {
 }
 
 /**
- * @brief Applies a convolution kernel to an input image to produce an output image but uses OpenMP.
+ * @brief Applies a convolution kernel to an input image to produce an output
+ * image but uses OpenMP.
+ *
+ * Legacy baseline kept for BM_OpenMP: every call forks its own parallel
+ * region and changes the global OpenMP thread count. Filter through
+ * ProcessingContext::convolve() instead.
  */
 #ifdef OPENMP
 template <typename Kernel>
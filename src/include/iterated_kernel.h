@@ -0,0 +1,19 @@
+#pragma once
+#include "image.h"
+#include "sparse_kernel.h"
+
+/**
+ * @brief Applies a kernel `iterations` times, with the same result as
+ * calling applyKernelSparse that many times on its own output.
+ *
+ * Time steps are blocked: each strip of rows advances up to 8 steps in a
+ * wavefront, keeping only 2 * (size / 2) + 1 rows per intermediate step in
+ * cache instead of writing every step back to a full image. Neighbouring
+ * strips recompute the shrinking halo between them (trapezoidal tiling).
+ * Same contract as applyKernelOpenMp: the image must be padded by
+ * size / 2, and the border stays fixed across iterations.
+ */
+Image applyKernelIterated(const Image &img, const SparseKernel &kernel,
+                          int iterations, Executor &executor);
+Image applyKernelIterated(const Image &img, const SparseKernel &kernel,
+                          int iterations, int nthreads);
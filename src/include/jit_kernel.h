@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "executor.h"
+#include "image.h"
+#include "image_processing.h"
+
+/**
+ * @brief Machine code generated at run time for one concrete kernel.
+ *
+ * The routine computes one output row from the k input rows converted to
+ * float: every non-zero tap becomes an unrolled AVX2 load + FMA against a
+ * broadcast constant, zero taps emit no code. Routines are cached per
+ * kernel, so repeated calls with the same coefficients reuse the code.
+ */
+class JitKernel {
+public:
+  /**
+   * @param rows k pointers to the first interior sample of each input row.
+   * @param count Number of output samples, a multiple of 8.
+   */
+  using RowFunction = void (*)(const float *const *rows, float *out,
+                               long count, const float *constants);
+
+  /**
+   * @brief Returns the cached routine for this kernel and channel count,
+   * generating it on first use, or nullptr when the CPU lacks AVX2/FMA or
+   * executable memory cannot be mapped.
+   */
+  static std::shared_ptr<const JitKernel> get(const Kernel &kernel,
+                                              int channels);
+
+  JitKernel(const JitKernel &) = delete;
+  JitKernel &operator=(const JitKernel &) = delete;
+  ~JitKernel();
+
+  void run(const float *const *rows, float *out, long count) const {
+    function(rows, out, count, constants.data());
+  }
+
+  size_t codeSize() const { return size; }
+
+  /// Non-zero taps, used for the scalar tail of each row
+  struct Tap {
+    int dy, dx;
+    float coefficient;
+  };
+  std::vector<Tap> taps;
+
+private:
+  JitKernel() = default;
+
+  void *code = nullptr;
+  size_t size = 0;
+  RowFunction function = nullptr;
+  std::vector<float> constants;
+};
+
+/**
+ * @brief Applies a kernel with its JIT-compiled row routine, falling back to
+ * applyKernelSparse when JIT is unavailable. Same contract as
+ * applyKernelOpenMp: the image must be padded by kernel.size() / 2.
+ */
+Image applyKernelJit(const Image &img, const Kernel &kernel,
+                     Executor &executor);
+Image applyKernelJit(const Image &img, const Kernel &kernel, int nthreads);
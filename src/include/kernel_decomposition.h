@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "executor.h"
+#include "image.h"
+#include "image_processing.h"
+
+/**
+ * @brief Singular value decomposition of a square kernel,
+ * K = sum_i sigma_i * u_i * v_i^T, with singular values in decreasing order.
+ *
+ * Each term is separable: a horizontal pass with v_i followed by a vertical
+ * pass with sigma_i * u_i. A kernel of rank r therefore costs r pairs of 1D
+ * passes instead of one dense k x k pass.
+ */
+struct KernelDecomposition {
+  int size = 0;
+  std::vector<float> singularValues;
+  std::vector<std::vector<float>> vertical;   ///< sigma_i * u_i
+  std::vector<std::vector<float>> horizontal; ///< v_i
+  /// errors[r]: Frobenius norm of K minus its rank r approximation
+  std::vector<float> errors;
+
+  static KernelDecomposition analyze(const Kernel &kernel);
+
+  /**
+   * @brief Smallest rank whose reconstruction error is at most tolerance.
+   */
+  int rankFor(float tolerance) const;
+
+  /**
+   * @brief Human readable table of the singular values and the
+   * reconstruction error per rank.
+   */
+  std::string report() const;
+};
+
+/**
+ * @enum ColumnPass
+ * @brief How applyKernelLowRank runs the vertical pass of each term.
+ */
+enum class ColumnPass {
+  Auto,      ///< Transposed for very wide rows, Rows otherwise.
+  Rows,      ///< Full-width row bands; vertical taps stride a whole row.
+  Transposed ///< Square tiles transposed so vertical taps become a row pass.
+};
+
+/**
+ * @brief Applies the rank-limited approximation of a kernel as a sum of
+ * separable passes. Same contract as applyKernelOpenMp: the image must be
+ * padded by size / 2 and the border is copied.
+ */
+Image applyKernelLowRank(const Image &img,
+                         const KernelDecomposition &decomposition, int rank,
+                         Executor &executor,
+                         ColumnPass columnPass = ColumnPass::Auto);
+Image applyKernelLowRank(const Image &img,
+                         const KernelDecomposition &decomposition, int rank,
+                         int nthreads,
+                         ColumnPass columnPass = ColumnPass::Auto);
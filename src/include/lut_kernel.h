@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "executor.h"
+#include "image.h"
+#include "image_processing.h"
+
+/**
+ * @brief A kernel turned into one 256-entry lookup table per non-zero tap.
+ *
+ * table[v] holds coefficient * v in fixed point, so a tap costs a table
+ * lookup and an integer add instead of a conversion and a float multiply.
+ */
+struct LutKernel {
+  struct Tap {
+    int dy, dx;
+    std::array<int32_t, 256> table;
+  };
+
+  int size = 0;
+  int fractionBits = 0;
+  std::vector<Tap> taps;
+
+  /**
+   * @brief Builds the tables with as many fraction bits (up to 16) as the
+   * sum of |coefficients| allows without overflowing 32 bit accumulators.
+   */
+  static LutKernel compile(const Kernel &kernel);
+};
+
+/**
+ * @brief Applies a lookup-table kernel, using AVX2 gathers when the CPU has
+ * them. Same contract as applyKernelOpenMp: the image must be padded by
+ * size / 2 and the border is copied.
+ */
+Image applyKernelLut(const Image &img, const LutKernel &kernel,
+                     Executor &executor);
+Image applyKernelLut(const Image &img, const LutKernel &kernel, int nthreads);
@@ -0,0 +1,31 @@
+#pragma once
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief Parameters of the non-local means denoiser.
+ */
+struct NonLocalMeansParams {
+  int searchRadius = 7; ///< Offsets searched in [-r, r]^2 around each pixel.
+  int patchRadius = 2;  ///< Patches are (2 * r + 1)^2 pixels.
+  float h = 10.0f;      ///< Filtering strength, in intensity units.
+  float sigma = 0.0f;   ///< Noise standard deviation subtracted from distances.
+  bool simd = true;     ///< Use AVX2 when the CPU has it; false forces scalar.
+};
+
+/**
+ * @brief Denoises an image with non-local means.
+ *
+ * Patch distances are computed per search offset from an integral image of
+ * squared differences, so the cost per pixel and offset is constant whatever
+ * the patch size. The image is split in tiles (and offsets are split in
+ * groups when there are few tiles) which are processed in parallel. The hot
+ * loops use AVX2 when the CPU supports it. Its polynomial exp differs from
+ * std::exp by a few ulp, so the two paths agree to within one intensity
+ * level rather than exactly. Borders are handled by edge replication, the
+ * input does not need to be padded.
+ */
+Image nonLocalMeans(const Image &img, const NonLocalMeansParams &params,
+                    Executor &executor);
+Image nonLocalMeans(const Image &img, const NonLocalMeansParams &params,
+                    int nthreads);
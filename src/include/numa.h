@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief CPUs of each NUMA node this process may run on.
+ *
+ * Read from /sys/devices/system/node/node<N>/cpulist and intersected with the
+ * affinity mask. Without that directory (or without any node) every allowed
+ * CPU is reported as one node.
+ */
+class NumaTopology {
+public:
+  explicit NumaTopology(std::vector<std::vector<int>> nodeCpus);
+
+  /**
+   * @brief Topology of the running system, read once.
+   */
+  static const NumaTopology &system();
+
+  int nodes() const { return nodeCpus.size(); }
+  const std::vector<int> &cpus(int node) const { return nodeCpus[node]; }
+  int totalCpus() const;
+
+  /**
+   * @brief Node of each of nthreads workers: contiguous blocks of workers
+   * per node, sized in proportion to the node's CPU count, so that static
+   * row bands of neighbouring workers share a node.
+   */
+  std::vector<int> workerNodes(int nthreads) const;
+
+  /**
+   * @brief CPU to pin each of nthreads workers to, following workerNodes()
+   * and cycling through the node's CPUs.
+   */
+  std::vector<int> workerCpus(int nthreads) const;
+
+private:
+  std::vector<std::vector<int>> nodeCpus;
+};
+
+/**
+ * @brief Parses a sysfs CPU list such as "0-3,8,10-11".
+ */
+std::vector<int> parseCpuList(const std::string &list);
+
+/**
+ * @enum NumaPlacement
+ * @brief Where numaAllocate() puts the pages of a buffer.
+ */
+enum class NumaPlacement {
+  FirstTouch = 0, ///< Each page lands on the node of its first writer.
+  Interleave = 1  ///< Pages spread round-robin over all nodes (mbind).
+};
+
+/**
+ * @brief Page-aligned anonymous mapping with the given placement; release it
+ * with numaFree(). Placement is a hint: if mbind is refused the buffer is
+ * still returned. Throws std::runtime_error when the mapping fails.
+ */
+unsigned char *numaAllocate(size_t bytes, NumaPlacement placement);
+void numaFree(unsigned char *data);
+
+/**
+ * @brief Uninitialized image whose buffer comes from numaAllocate().
+ */
+Image numaImage(int width, int height, int channels, NumaPlacement placement);
+
+/**
+ * @brief Copies img into a numaImage(), one row band per task. With
+ * FirstTouch on a ThreadPool in RowBands schedule, every band's pages end up
+ * on the node of the worker that later filters the same rows.
+ */
+Image placeRowBands(const Image &img, Executor &executor,
+                    NumaPlacement placement = NumaPlacement::FirstTouch);
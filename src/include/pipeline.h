@@ -0,0 +1,186 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "batch_processor.h"
+
+/**
+ * @brief Waits a little longer on every round: pauses first, then yields,
+ * then sleeps, so a blocked stage leaves the CPU to the others.
+ */
+void queueBackoff(int round);
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer FIFO queue.
+ *
+ * Dmitry Vyukov's array queue: every cell carries a sequence number that
+ * says whether it is free for the producer at that position or filled for
+ * the consumer, so producers and consumers only contend on their own
+ * position counter. The capacity is rounded up to a power of two.
+ *
+ * The blocking push() and pop() back off instead of sleeping on a lock.
+ * close() ends the stream: pushes fail from then on, pops drain what is
+ * left and then fail.
+ */
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    mask = size - 1;
+    cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  /**
+   * @brief Moves item in unless the queue is full.
+   */
+  bool tryPush(T &item) {
+    Cell *cell;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Moves the oldest item out unless the queue is empty.
+   */
+  bool tryPop(T &item) {
+    Cell *cell;
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    item = std::move(cell->value);
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Waits for room; false once the queue is closed.
+   */
+  bool push(T &item) {
+    for (int round = 0; !closed.load(std::memory_order_acquire); round++) {
+      if (tryPush(item)) {
+        return true;
+      }
+      queueBackoff(round);
+    }
+    return false;
+  }
+
+  /**
+   * @brief Waits for an item; false once the queue is closed and empty.
+   */
+  bool pop(T &item) {
+    for (int round = 0;; round++) {
+      if (tryPop(item)) {
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire)) {
+        // Items pushed before close() are visible now
+        return tryPop(item);
+      }
+      queueBackoff(round);
+    }
+  }
+
+  void close() { closed.store(true, std::memory_order_release); }
+
+private:
+  struct alignas(64) Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueuePos{0};
+  alignas(64) std::atomic<size_t> dequeuePos{0};
+  std::atomic<bool> closed{false};
+};
+
+/**
+ * @brief Worker counts of the pipeline stages.
+ */
+struct PipelineOptions {
+  int decoders = 1;
+  /// Images filtered at the same time
+  int filterWorkers = 1;
+  /// Pool threads inside each filter worker
+  int filterThreads = 1;
+  int encoders = 1;
+  /// Images waiting between two stages
+  int queueCapacity = 4;
+};
+
+/**
+ * @brief Busy time of each stage, summed over its workers, and the wall time
+ * of the whole run; busy times adding up to more than the wall time show
+ * how much the stages overlapped.
+ */
+struct PipelineStats {
+  int images = 0;
+  double decodeSeconds = 0;
+  double filterSeconds = 0;
+  double encodeSeconds = 0;
+  double wallSeconds = 0;
+};
+
+/**
+ * @brief Decodes, filters and encodes a batch as a three-stage pipeline.
+ *
+ * Every stage has its own threads, linked by BoundedQueue hand-offs of
+ * options.queueCapacity images, so decoding image N+1 and encoding image
+ * N-1 overlap with filtering image N while at most a few decoded images
+ * wait in memory. Each filter worker runs the filter on its own ThreadPool
+ * of options.filterThreads. The sink is the encode stage: it runs on an
+ * encoder thread, once per item, in no particular order. The first
+ * exception thrown by a stage closes both queues and is rethrown once
+ * every stage stopped.
+ */
+PipelineStats runPipeline(const std::vector<BatchItem> &items,
+                          const BatchProcessor::Filter &filter,
+                          const BatchProcessor::Sink &sink,
+                          const PipelineOptions &options = PipelineOptions());
@@ -0,0 +1,72 @@
+#pragma once
+#include "convolution.h"
+#include "guided_filter.h"
+#include "image.h"
+#include "numa.h"
+#include "non_local_means.h"
+#include "pyramid.h"
+#include "resample.h"
+#include "thread_pool.h"
+#include "unsharp_mask.h"
+
+/**
+ * @brief Owns the worker pool every filter of a session runs on.
+ *
+ * Create one context for a batch of images and call the filters through it:
+ * the threads are started once and stay pinned, instead of every call
+ * forking its own parallel region. Calls from several threads are safe but
+ * run one at a time.
+ */
+class ProcessingContext {
+public:
+  /**
+   * @param schedule RowBands keeps each worker on the same rows from pass to
+   * pass; combine it with placeRowBands() on multi-socket machines.
+   */
+  explicit ProcessingContext(int nthreads,
+                             PoolSchedule schedule = PoolSchedule::Dynamic);
+
+  ProcessingContext(const ProcessingContext &) = delete;
+  ProcessingContext &operator=(const ProcessingContext &) = delete;
+
+  /**
+   * @brief Process-wide context with nthreads workers, started on first use
+   * and kept until exit. The filters' `int nthreads` overloads run on it, so
+   * repeated calls reuse its threads instead of forking their own.
+   */
+  static ProcessingContext &shared(int nthreads);
+
+  /**
+   * @brief The pool, for the Executor overloads of other filters.
+   */
+  Executor &executor() { return pool; }
+  int threads() const { return pool.workers(); }
+
+  Image convolve(Image &img, const Kernel &kernel,
+                 const ConvolutionOptions &options = ConvolutionOptions());
+  Image unsharpMask(const Image &img, const UnsharpMaskParams &params);
+  Image resize(const Image &img, int width, int height,
+               ResampleFilter filter);
+  Image resizeAndBlur(const Image &img, int width, int height,
+                      ResampleFilter filter, float sigma);
+  Image guidedFilter(const Image &guide, const Image &input, int radius,
+                     float epsilon);
+  Image nonLocalMeans(const Image &img, const NonLocalMeansParams &params);
+  Image transpose(const Image &img);
+
+  /**
+   * @brief Copy of img with its row bands first touched by the workers that
+   * filter them (or interleaved), see placeRowBands().
+   */
+  Image placeRowBands(const Image &img,
+                      NumaPlacement placement = NumaPlacement::FirstTouch);
+
+  /**
+   * @brief Pyramid whose levels are built on this context's pool; it must
+   * not outlive the context.
+   */
+  ImagePyramid pyramid(const Image &base, int levels);
+
+private:
+  ThreadPool pool;
+};
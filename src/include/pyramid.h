@@ -0,0 +1,76 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "executor.h"
+#include "float_image.h"
+#include "image.h"
+
+/**
+ * @brief Fused 5-tap binomial blur + 2x decimation.
+ *
+ * Only the even output rows and columns are ever evaluated, so no
+ * full-resolution blurred intermediate is produced.
+ */
+FloatImage pyrDown(const FloatImage &img, Executor &executor);
+FloatImage pyrDown(const FloatImage &img, int nthreads);
+
+/**
+ * @brief 2x upsampling with the matching binomial interpolation, producing an
+ * image of the requested size (which must be at most twice the input).
+ */
+FloatImage pyrUp(const FloatImage &img, int width, int height,
+                 Executor &executor);
+FloatImage pyrUp(const FloatImage &img, int width, int height, int nthreads);
+
+/**
+ * @brief Gaussian and Laplacian pyramids of an image with lazily built,
+ * cached levels.
+ *
+ * Level 0 is the full resolution image. Every level is computed at most once;
+ * later queries return the cached level. Accessors are safe to call from
+ * several threads.
+ */
+class ImagePyramid {
+public:
+  /**
+   * @param levels Number of levels, clamped so the coarsest level is at least
+   * one pixel wide. Values <= 0 build as many levels as possible.
+   */
+  ImagePyramid(const Image &base, int levels, int nthreads);
+  /**
+   * @brief Builds the levels on `executor`, which must outlive the pyramid.
+   */
+  ImagePyramid(const Image &base, int levels, Executor &executor);
+
+  int levels() const { return numLevels; }
+
+  const FloatImage &gaussian(int level);
+
+  /**
+   * @brief Band-pass level: gaussian(level) - pyrUp(gaussian(level + 1)).
+   * The coarsest level holds the residual low-pass image.
+   */
+  const FloatImage &laplacian(int level);
+
+  /**
+   * @brief Builds every level. Gaussian levels are built coarser one after the
+   * other, then all Laplacian levels are built in parallel.
+   */
+  void buildAll();
+
+  /**
+   * @brief Collapses the Laplacian pyramid back to a full resolution image.
+   */
+  Image reconstruct();
+
+private:
+  void init(const Image &base, int levels);
+
+  Executor *executor;
+  int numLevels;
+  std::vector<FloatImage> gaussianLevels;
+  std::vector<FloatImage> laplacianLevels;
+  std::unique_ptr<std::once_flag[]> gaussianBuilt;
+  std::unique_ptr<std::once_flag[]> laplacianBuilt;
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @enum ResampleFilter
+ * @brief Reconstruction filters supported by the resampler.
+ */
+enum class ResampleFilter {
+  Box = 0,      ///< Area average, support 0.5.
+  Bilinear = 1, ///< Triangle filter, support 1.
+  Bicubic = 2,  ///< Catmull-Rom cubic (a = -0.5), support 2.
+  Lanczos3 = 3  ///< Windowed sinc, support 3.
+};
+
+/**
+ * @brief Precomputed 1D resampling taps for one axis.
+ *
+ * Output sample i reads source samples start[i] .. start[i] + taps - 1 with
+ * weights weights[i * taps ..]. Shorter footprints are zero padded so every
+ * output has the same number of taps, and taps falling outside the source
+ * are folded onto the edge samples.
+ */
+struct ResampleWeights {
+  int taps = 0;
+  std::vector<int> start;
+  std::vector<float> weights;
+
+  /**
+   * @param blur Optional normalized 1D kernel applied in output space; its
+   * taps are folded into the table so resampling and blurring cost a single
+   * pass.
+   */
+  static ResampleWeights compute(int srcSize, int dstSize,
+                                 ResampleFilter filter,
+                                 const std::vector<float> &blur = {});
+};
+
+/**
+ * @brief Resizes an image with a separable filter. The horizontal and the
+ * vertical pass are both parallelized across rows.
+ */
+Image resize(const Image &img, int width, int height, ResampleFilter filter,
+             Executor &executor);
+Image resize(const Image &img, int width, int height, ResampleFilter filter,
+             int nthreads);
+
+/**
+ * @brief Resizes an image and applies a Gaussian blur of the given sigma (in
+ * output pixels) in the same two passes.
+ */
+Image resizeAndBlur(const Image &img, int width, int height,
+                    ResampleFilter filter, float sigma, Executor &executor);
+Image resizeAndBlur(const Image &img, int width, int height,
+                    ResampleFilter filter, float sigma, int nthreads);
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include "executor.h"
+#include "image.h"
+#include "image_processing.h"
+
+/**
+ * @brief A kernel preprocessed for sparse evaluation.
+ *
+ * Zero taps are dropped and taps whose coefficients have the same magnitude
+ * are grouped: the pixels of a group are added (or subtracted, for opposite
+ * signs) first and multiplied once. Symmetric and antisymmetric pairs fold
+ * this way, so the cost is one add per non-zero tap plus one multiply per
+ * distinct coefficient magnitude instead of k^2 multiply-adds.
+ */
+struct SparseKernel {
+  struct Tap {
+    int dy, dx;    ///< Offset from the output pixel.
+    bool negative; ///< Subtract instead of add the pixel.
+  };
+  struct Group {
+    float coefficient;
+    std::vector<Tap> taps;
+  };
+
+  /// Samples of an output row handled at once, so group sums stay in L1.
+  static constexpr int ROW_CHUNK = 1024;
+
+  int size = 0;
+  int nonZeroTaps = 0;
+  std::vector<Group> groups;
+
+  /**
+   * @param tolerance Coefficients whose magnitudes differ by at most this
+   * much share a group; magnitudes at most this large are dropped.
+   */
+  static SparseKernel compile(const Kernel &kernel, float tolerance = 1e-7f);
+};
+
+/**
+ * @brief Computes samples [begin, end) of one output row into out.
+ *
+ * rows[i] is the input row at vertical offset i - size / 2; with 4 channels
+ * alpha is copied from the centre row. acc and groupSum are scratch of
+ * SparseKernel::ROW_CHUNK floats each.
+ */
+void applySparseRow(const SparseKernel &kernel,
+                    const unsigned char *const *rows, int channels, int begin,
+                    int end, float *acc, float *groupSum, unsigned char *out);
+
+/**
+ * @brief Applies a preprocessed kernel. Same contract as applyKernelOpenMp:
+ * the image must be padded by size / 2 and the border is copied.
+ */
+Image applyKernelSparse(const Image &img, const SparseKernel &kernel,
+                        Executor &executor);
+Image applyKernelSparse(const Image &img, const SparseKernel &kernel,
+                        int nthreads);
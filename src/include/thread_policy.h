@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "image_processing.h"
+
+/**
+ * @brief Logical CPUs this process may use and the physical cores behind
+ * them.
+ */
+struct CpuTopology {
+  int logicalCpus = 1;
+  int physicalCores = 1;
+
+  int threadsPerCore() const {
+    return (logicalCpus + physicalCores - 1) / physicalCores;
+  }
+
+  /**
+   * @brief Topology of the allowed CPUs, from the thread_siblings_list of
+   * each in /sys/devices/system/cpu. CPUs without that file count as one
+   * core each. Read once.
+   */
+  static const CpuTopology &system();
+
+  /**
+   * @brief Topology from the thread_siblings_list of every allowed CPU: CPUs
+   * with the same list share a core.
+   */
+  static CpuTopology fromSiblingLists(const std::vector<std::string> &lists);
+
+  /**
+   * @brief The share of one of `processes` processes splitting the machine,
+   * e.g. MPI ranks on the same node. Never less than one core.
+   */
+  CpuTopology sharedBy(int processes) const;
+};
+
+/**
+ * @brief Worker count chosen by chooseThreadCount() and why.
+ */
+struct ThreadDecision {
+  int threads = 1;
+  bool smt = false; ///< More threads than physical cores.
+  std::string reason;
+
+  /**
+   * @brief One line such as "Using 8 threads: 34.6M samples x 9 ops,
+   * memory-bound kernel: one thread per core of 8 cores / 16 CPUs".
+   */
+  std::string report() const;
+};
+
+/**
+ * @brief Picks how many workers a filter pass should use.
+ *
+ * Every worker gets at least about a millisecond of work, so small images
+ * stay on few threads. Kernels with few operations per sample are limited
+ * by memory bandwidth and get one thread per physical core; heavier ones
+ * also use SMT siblings.
+ *
+ * @param samples Output samples (width * height * channels).
+ * @param opsPerSample Multiply-adds per sample, see kernelOpsPerSample().
+ */
+ThreadDecision chooseThreadCount(long samples, double opsPerSample,
+                                 const CpuTopology &topology =
+                                     CpuTopology::system());
+
+/**
+ * @brief Operations per sample of a convolution with this kernel: its
+ * non-zero taps.
+ */
+double kernelOpsPerSample(const Kernel &kernel);
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "executor.h"
+
+/**
+ * @enum PoolSchedule
+ * @brief How a ThreadPool hands tasks to its workers.
+ */
+enum class PoolSchedule {
+  Dynamic = 0, ///< Workers claim the next task from a shared counter.
+  RowBands = 1 ///< Worker w runs the w-th contiguous band of the tasks.
+};
+
+/**
+ * @brief Executor backed by long-lived worker threads.
+ *
+ * The nthreads - 1 helper threads are started once and pinned by NUMA
+ * topology: consecutive workers fill one node before the next (see
+ * NumaTopology::workerCpus()). The thread calling parallelFor() works as
+ * worker 0. With the RowBands schedule the same worker always gets the same
+ * rows of same-sized jobs, so rows first touched by a worker stay on its
+ * node for the following passes. Between jobs the helpers spin briefly,
+ * then sleep on a condition variable, so back-to-back calls on small images
+ * pay neither a thread fork nor a wake-up (with more threads than CPUs
+ * nobody spins). Calls from different threads are serialized; a call from
+ * inside a task runs inline. The first exception thrown by a task stops the
+ * remaining tasks from being claimed and is rethrown by parallelFor().
+ */
+class ThreadPool : public Executor {
+public:
+  /**
+   * @param pin Pin helper threads to CPUs (Linux only, ignored elsewhere).
+   */
+  explicit ThreadPool(int nthreads, bool pin = true,
+                      PoolSchedule schedule = PoolSchedule::Dynamic);
+  ~ThreadPool() override;
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return nthreads; }
+  const char *name() const override { return "pool"; }
+
+private:
+  void workerLoop(int worker, int cpu);
+  void run(int task, int worker);
+  void drain(int worker);
+
+  int nthreads;
+  PoolSchedule schedule;
+  // Zero when there are more threads than CPUs
+  int spinIterations;
+  std::vector<std::thread> threads;
+
+  // Serializes parallelFor() callers
+  std::mutex submitMutex;
+
+  // Current job, published by bumping generation under mutex
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  std::atomic<uint64_t> generation{0};
+  bool stopping = false;
+  const Task *job = nullptr;
+  int jobCount = 0;
+  std::atomic<int> next{0};
+  std::atomic<int> pending{0};
+  std::exception_ptr error;
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief Transposes a width x height block of interleaved pixels into a
+ * height x width block; strides are in samples.
+ *
+ * The block is split recursively along its larger side until it fits in
+ * cache (cache-oblivious), then moved in 4x4 pixel tiles with SSE: 4-channel
+ * 8 bit pixels as 32 bit lanes, 4-channel float pixels as whole registers.
+ */
+void transposePixels(const unsigned char *src, int srcStride,
+                     unsigned char *dst, int dstStride, int width, int height,
+                     int channels);
+void transposePixels(const float *src, int srcStride, float *dst,
+                     int dstStride, int width, int height, int channels);
+
+/**
+ * @brief Returns the transposed image (width and height swapped).
+ */
+Image transposeImage(const Image &img, Executor &executor);
+Image transposeImage(const Image &img, int nthreads);
@@ -0,0 +1,24 @@
+#pragma once
+#include "executor.h"
+#include "image.h"
+
+/**
+ * @brief Parameters of the unsharp mask: out = in + amount * (in - blur(in)).
+ */
+struct UnsharpMaskParams {
+  float sigma = 1.0f;  ///< Sigma of the separable Gaussian blur.
+  float amount = 1.0f; ///< Strength of the sharpening.
+  int threshold = 0;   ///< Minimum |in - blur| for a sample to be sharpened.
+};
+
+/**
+ * @brief Sharpens an image with a fused unsharp mask.
+ *
+ * The blur and the combination are computed tile by tile in a single sweep,
+ * so no full-resolution blurred intermediate is ever written. Borders are
+ * handled by edge replication, the input does not need to be padded.
+ */
+Image unsharpMask(const Image &img, const UnsharpMaskParams &params,
+                  Executor &executor);
+Image unsharpMask(const Image &img, const UnsharpMaskParams &params,
+                  int nthreads);
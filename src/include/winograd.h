@@ -0,0 +1,21 @@
+#pragma once
+#include "executor.h"
+#include "image.h"
+#include "image_processing.h"
+
+/**
+ * @brief Applies an arbitrary 3x3 kernel with Winograd F(2x2, 3x3) minimal
+ * filtering: 16 instead of 36 multiplications per 2x2 output tile.
+ *
+ * Same contract as applyKernelOpenMp: the image is expected to be padded by
+ * one pixel, border pixels are copied from the input and results are
+ * truncated to [0, 255]. Input, filter and output transforms are evaluated
+ * on contiguous arrays holding one row of tiles, so they vectorize.
+ * convolve() only runs it for ConvolutionBackend::Winograd: in
+ * BM_Convolve3x3 it is about three times slower than the sparse and JIT
+ * backends, so Auto never selects it.
+ */
+Image applyKernelWinograd3x3(const Image &img, const Kernel &kernel,
+                             Executor &executor);
+Image applyKernelWinograd3x3(const Image &img, const Kernel &kernel,
+                             int nthreads);
@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "executor.h"
+#include "thread_pool.h"
+
+/**
+ * @brief Half-open range [begin, end) of task indices.
+ */
+struct TaskRange {
+  int begin = 0;
+  int end = 0;
+  int size() const { return end - begin; }
+};
+
+/**
+ * @brief Fixed-capacity Chase–Lev work-stealing deque of task ranges.
+ *
+ * The owning thread pushes and takes at the bottom; any other thread may
+ * steal from the top. Ranges are packed in 64 bit atomics, so steals never
+ * read a torn entry. Memory orders follow Lê et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ */
+class ChaseLevDeque {
+public:
+  static constexpr int CAPACITY = 64;
+
+  /**
+   * @brief Owner only. Returns false, leaving the deque unchanged, when full.
+   */
+  bool push(TaskRange range);
+  /**
+   * @brief Owner only. Takes the most recently pushed range.
+   */
+  bool take(TaskRange &range);
+  /**
+   * @brief Any thread. Takes the oldest range; fails when the deque is empty
+   * or another thread won the race for it.
+   */
+  bool steal(TaskRange &range);
+
+private:
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::atomic<uint64_t> slots[CAPACITY];
+};
+
+/**
+ * @brief Load-balance counters of one worker, summed over every
+ * parallelFor() since the last WorkStealingExecutor::resetStats().
+ */
+struct WorkerStats {
+  long tasks = 0;        ///< Tasks run.
+  long chunks = 0;       ///< Contiguous runs of tasks, one timing each.
+  long steals = 0;       ///< Ranges taken from other workers.
+  long failedSteals = 0; ///< Steal attempts that found nothing.
+  double busySeconds = 0; ///< Time spent running tasks.
+};
+
+/**
+ * @brief Executor that balances uneven tasks by work stealing.
+ *
+ * Each worker starts with an equal share of the task range in its own
+ * deque and splits whatever it takes in halves, pushing the upper half back,
+ * until the piece is no larger than its current grain. Idle workers steal
+ * the oldest, largest halves from random victims. The grain adapts to the
+ * measured cost per task so one chunk takes about TARGET_CHUNK_SECONDS: cheap
+ * rows are batched, expensive tiles run one at a time. Workers run on a
+ * ThreadPool owned by the executor.
+ */
+class WorkStealingExecutor : public Executor {
+public:
+  static constexpr double TARGET_CHUNK_SECONDS = 50e-6;
+
+  explicit WorkStealingExecutor(int nthreads);
+
+  void parallelFor(int count, const Task &task) override;
+  int workers() const override { return pool.workers(); }
+  const char *name() const override { return "stealing"; }
+
+  std::vector<WorkerStats> stats() const;
+  void resetStats();
+
+  /**
+   * @brief Busiest worker's busy time over the mean busy time; 1 is perfect
+   * balance.
+   */
+  double loadImbalance() const;
+
+private:
+  struct alignas(64) Slot {
+    ChaseLevDeque deque;
+    WorkerStats stats;
+  };
+
+  void runSlot(int slot, int worker, const Task &task);
+
+  ThreadPool pool;
+  std::vector<Slot> slots;
+  std::mutex submitMutex;
+  std::atomic<int> remaining{0};
+  std::atomic<bool> aborted{false};
+  int maxGrain = 1;
+};
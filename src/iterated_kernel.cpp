@@ -0,0 +1,128 @@
+#include "include/iterated_kernel.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+// Output rows per strip; each strip recomputes 2 * (steps - 1) * kHalf rows
+// of halo, so taller strips waste less
+constexpr int STRIP_ROWS = 128;
+// Steps fused per sweep; the halo grows linearly with it
+constexpr int TIME_BLOCK = 8;
+
+// Advances `in` by `steps` iterations into `out`, whose border rows already
+// match `in`; the strip writing an interior row copies its border columns
+void advance(const unsigned char *in, unsigned char *out,
+             const SparseKernel &kernel, int width, int height, int channels,
+             int steps, Executor &executor) {
+  const int rowLen = width * channels;
+  const int kHalf = kernel.size / 2;
+  const int slots = 2 * kHalf + 1;
+  const int begin = kHalf * channels;
+  const int end = (width - kHalf) * channels;
+  const int strips = (height - 2 * kHalf + STRIP_ROWS - 1) / STRIP_ROWS;
+
+  struct Scratch {
+    // ring[t - 1] holds the most recent `slots` rows of step t
+    std::vector<std::vector<unsigned char>> ring;
+    std::vector<const unsigned char *> rows;
+    std::vector<float> acc, groupSum;
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(strips, [&](int strip, int worker) {
+    Scratch &s = scratch[worker];
+    if (s.rows.empty()) {
+      s.ring.assign(steps - 1, std::vector<unsigned char>(slots * rowLen));
+      s.rows.resize(kernel.size);
+      s.acc.resize(SparseKernel::ROW_CHUNK);
+      s.groupSum.resize(SparseKernel::ROW_CHUNK);
+    }
+    const int y0 = kHalf + strip * STRIP_ROWS;
+    const int y1 = std::min(y0 + STRIP_ROWS, height - kHalf);
+    // Rows of step t this strip needs, shrinking towards [y0, y1)
+    auto first = [&](int t) {
+      return std::max(kHalf, y0 - (steps - t) * kHalf);
+    };
+    auto last = [&](int t) {
+      return std::min(height - kHalf, y1 + (steps - t) * kHalf);
+    };
+    // Border rows never change and step 0 is the input
+    auto stepRow = [&](int t, int r) -> const unsigned char * {
+      if (t == 0 || r < kHalf || r >= height - kHalf) {
+        return in + r * rowLen;
+      }
+      return s.ring[t - 1].data() + (r % slots) * rowLen;
+    };
+
+    // Wavefront: step t trails step t - 1 by kHalf rows, so the rows it
+    // reads were produced in this or the previous kHalf sweeps
+    for (int lead = first(1); lead < last(1) + (steps - 1) * kHalf; lead++) {
+      for (int t = 1; t <= steps; t++) {
+        const int y = lead - (t - 1) * kHalf;
+        if (y < first(t) || y >= last(t)) {
+          continue;
+        }
+        for (int ky = 0; ky < kernel.size; ky++) {
+          s.rows[ky] = stepRow(t - 1, y + ky - kHalf);
+        }
+        unsigned char *dst = t == steps
+                                 ? out + y * rowLen
+                                 : s.ring[t - 1].data() + (y % slots) * rowLen;
+        memcpy(dst, s.rows[kHalf], begin);
+        memcpy(dst + end, s.rows[kHalf] + end, rowLen - end);
+        applySparseRow(kernel, s.rows.data(), channels, begin, end,
+                       s.acc.data(), s.groupSum.data(), dst);
+      }
+    }
+  });
+}
+} // namespace
+
+Image applyKernelIterated(const Image &img, const SparseKernel &kernel,
+                          int iterations, Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int size = width * height * channels;
+  const int rowLen = width * channels;
+  const int kHalf = kernel.size / 2;
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[size];
+  if (iterations <= 0) {
+    memcpy(output, src, size);
+    return Image(output, width, height, channels);
+  }
+
+  // Blocks of TIME_BLOCK steps ping-pong between output and scratch, ending
+  // in output. Only their border rows are copied here, so interior pages are
+  // first touched by the strips writing them (see applyKernelSparse).
+  const int blocks = (iterations + TIME_BLOCK - 1) / TIME_BLOCK;
+  std::unique_ptr<unsigned char[]> scratch;
+  if (blocks > 1) {
+    scratch.reset(new unsigned char[size]);
+  }
+  for (unsigned char *buffer : {output, scratch.get()}) {
+    if (buffer) {
+      memcpy(buffer, src, kHalf * rowLen);
+      memcpy(buffer + (height - kHalf) * rowLen,
+             src + (height - kHalf) * rowLen, kHalf * rowLen);
+    }
+  }
+  const unsigned char *in = src;
+  for (int b = 0; b < blocks; b++) {
+    const int steps = std::min(TIME_BLOCK, iterations - b * TIME_BLOCK);
+    unsigned char *out = (blocks - 1 - b) % 2 == 0 ? output : scratch.get();
+    advance(in, out, kernel, width, height, channels, steps, executor);
+    in = out;
+  }
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelIterated(const Image &img, const SparseKernel &kernel,
+                          int iterations, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelIterated(img, kernel, iterations, executor);
+}
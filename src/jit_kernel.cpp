@@ -0,0 +1,282 @@
+#include "include/jit_kernel.h"
+#include "include/processing_context.h"
+#include "include/sparse_kernel.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unordered_map>
+
+namespace {
+// Output rows per scheduling unit; consecutive rows reuse converted inputs
+constexpr int BAND_ROWS = 32;
+
+/**
+ * Minimal x86-64 encoder for the handful of instructions the row routine
+ * needs. Register usage (System V): rdi = rows, rsi = out, rdx = count,
+ * rcx = constants, r8 = sample index, rax = current input row.
+ */
+class Emitter {
+public:
+  std::vector<uint8_t> code;
+
+  void bytes(std::initializer_list<uint8_t> list) {
+    code.insert(code.end(), list);
+  }
+  void dword(int32_t value) {
+    for (int i = 0; i < 4; i++) {
+      code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+  size_t position() const { return code.size(); }
+  void patchRel32(size_t at, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (at + 4));
+    memcpy(code.data() + at, &rel, 4);
+  }
+
+  // test rdx, rdx ; jle rel32 (patched later), returns the rel32 position
+  size_t testCountJumpIfEmpty() {
+    bytes({0x48, 0x85, 0xD2, 0x0F, 0x8E});
+    dword(0);
+    return position() - 4;
+  }
+  // xor r8d, r8d
+  void zeroIndex() { bytes({0x45, 0x31, 0xC0}); }
+  // vxorps ymmN, ymmN, ymmN (N < 8)
+  void zeroYmm(int n) {
+    bytes({0xC5, static_cast<uint8_t>(0x84 | ((~n & 0xF) << 3)), 0x57,
+           static_cast<uint8_t>(0xC0 | (n << 3) | n)});
+  }
+  // mov rax, [rdi + disp32]
+  void loadRowPointer(int32_t disp) {
+    bytes({0x48, 0x8B, 0x87});
+    dword(disp);
+  }
+  // vmovups ymm1, [rax + r8 * 4 + disp32]
+  void loadInput(int32_t disp) {
+    bytes({0xC4, 0xA1, 0x7C, 0x10, 0x8C, 0x80});
+    dword(disp);
+  }
+  // vfmadd231ps ymmAcc, ymm1, [rcx + disp32]
+  void fmaConstant(int acc, int32_t disp) {
+    bytes({0xC4, 0xE2, 0x75, 0xB8, static_cast<uint8_t>(0x81 | (acc << 3))});
+    dword(disp);
+  }
+  // vaddps ymm0, ymm0, ymm2
+  void mergeAccumulators() { bytes({0xC5, 0xFC, 0x58, 0xC2}); }
+  // vmovups [rsi + r8 * 4], ymm0
+  void storeOutput() { bytes({0xC4, 0xA1, 0x7C, 0x11, 0x04, 0x86}); }
+  // add r8, 8 ; cmp r8, rdx ; jl target
+  void loopBack(size_t target) {
+    bytes({0x49, 0x83, 0xC0, 0x08, 0x49, 0x39, 0xD0, 0x0F, 0x8C});
+    dword(0);
+    patchRel32(position() - 4, target);
+  }
+  // vzeroupper ; ret
+  void epilogue() { bytes({0xC5, 0xF8, 0x77, 0xC3}); }
+};
+
+uint64_t kernelHash(const Kernel &kernel, int channels) {
+  uint64_t hash = 1469598103934665603ull;
+  auto mix = [&](uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      hash ^= (value >> (8 * i)) & 0xFF;
+      hash *= 1099511628211ull;
+    }
+  };
+  mix(kernel.size());
+  mix(channels);
+  for (const auto &row : kernel) {
+    for (float value : row) {
+      uint32_t bits;
+      memcpy(&bits, &value, 4);
+      mix(bits);
+    }
+  }
+  return hash;
+}
+
+struct CacheEntry {
+  Kernel kernel;
+  int channels;
+  std::shared_ptr<const JitKernel> routine;
+};
+
+std::mutex cacheMutex;
+std::unordered_multimap<uint64_t, CacheEntry> cache;
+} // namespace
+
+JitKernel::~JitKernel() {
+  if (code) {
+    munmap(code, size);
+  }
+}
+
+std::shared_ptr<const JitKernel> JitKernel::get(const Kernel &kernel,
+                                                int channels) {
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (!supported) {
+    return nullptr;
+  }
+
+  const uint64_t hash = kernelHash(kernel, channels);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  auto range = cache.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.channels == channels && it->second.kernel == kernel) {
+      return it->second.routine;
+    }
+  }
+
+  std::shared_ptr<JitKernel> routine(new JitKernel());
+  const int kHalf = kernel.size() / 2;
+  Emitter emit;
+  size_t skip = emit.testCountJumpIfEmpty();
+  emit.zeroIndex();
+  size_t loop = emit.position();
+  emit.zeroYmm(0);
+  emit.zeroYmm(2);
+  int acc = 0;
+  for (int ky = 0; ky < static_cast<int>(kernel.size()); ky++) {
+    bool rowLoaded = false;
+    for (int kx = 0; kx < static_cast<int>(kernel.size()); kx++) {
+      float coefficient = kernel[ky][kx];
+      if (coefficient == 0.0f) {
+        continue;
+      }
+      if (!rowLoaded) {
+        emit.loadRowPointer(ky * 8);
+        rowLoaded = true;
+      }
+      int32_t constOffset = routine->constants.size() * sizeof(float);
+      routine->constants.insert(routine->constants.end(), 8, coefficient);
+      routine->taps.push_back({ky - kHalf, kx - kHalf, coefficient});
+      emit.loadInput((kx - kHalf) * channels * 4);
+      // Alternate between two accumulators to halve the FMA dependency chain
+      emit.fmaConstant(acc, constOffset);
+      acc ^= 2;
+    }
+  }
+  emit.mergeAccumulators();
+  emit.storeOutput();
+  emit.loopBack(loop);
+  emit.patchRel32(skip, emit.position());
+  emit.epilogue();
+
+  routine->size = emit.code.size();
+  void *memory = mmap(nullptr, routine->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  memcpy(memory, emit.code.data(), routine->size);
+  if (mprotect(memory, routine->size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, routine->size);
+    return nullptr;
+  }
+  routine->code = memory;
+  routine->function = reinterpret_cast<RowFunction>(memory);
+
+  cache.emplace(hash, CacheEntry{kernel, channels, routine});
+  return routine;
+}
+
+Image applyKernelJit(const Image &img, const Kernel &kernel,
+                     Executor &executor) {
+  std::shared_ptr<const JitKernel> routine = JitKernel::get(kernel,
+                                                            img.channels);
+  if (!routine) {
+    return applyKernelSparse(img, SparseKernel::compile(kernel), executor);
+  }
+
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  const int size = kernel.size();
+  const int kHalf = size / 2;
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[width * height * channels];
+  // Border rows here, border columns by the worker owning each row (see
+  // applyKernelSparse)
+  memcpy(output, src, kHalf * rowLen);
+  memcpy(output + (height - kHalf) * rowLen, src + (height - kHalf) * rowLen,
+         kHalf * rowLen);
+
+  const int begin = kHalf * channels;
+  const int len = (width - 2 * kHalf) * channels;
+  const long vectorLen = len & ~7L;
+  const int interiorRows = height - 2 * kHalf;
+  const int bands = (interiorRows + BAND_ROWS - 1) / BAND_ROWS;
+
+  struct Scratch {
+    // Ring of the last `size` input rows converted to float
+    std::vector<std::vector<float>> ring;
+    std::vector<int> ringRow;
+    std::vector<const float *> rows;
+    std::vector<float> out;
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(bands, [&](int band, int worker) {
+    Scratch &s = scratch[worker];
+    if (s.rows.empty()) {
+      s.ring.assign(size, std::vector<float>(rowLen));
+      s.ringRow.assign(size, -1);
+      s.rows.resize(size);
+      s.out.resize(len);
+    }
+    const int y0 = kHalf + band * BAND_ROWS;
+    const int y1 = std::min(y0 + BAND_ROWS, height - kHalf);
+    for (int y = y0; y < y1; y++) {
+      for (int ky = 0; ky < size; ky++) {
+        const int r = y + ky - kHalf;
+        const int slot = r % size;
+        if (s.ringRow[slot] != r) {
+          const unsigned char *in = src + r * rowLen;
+          float *f = s.ring[slot].data();
+#pragma omp simd
+          for (int j = 0; j < rowLen; j++) {
+            f[j] = in[j];
+          }
+          s.ringRow[slot] = r;
+        }
+        s.rows[ky] = s.ring[slot].data() + begin;
+      }
+
+      routine->run(s.rows.data(), s.out.data(), vectorLen);
+      for (int j = vectorLen; j < len; j++) {
+        float sum = 0.0f;
+        for (const auto &tap : routine->taps) {
+          sum +=
+              tap.coefficient * s.rows[tap.dy + kHalf][j + tap.dx * channels];
+        }
+        s.out[j] = sum;
+      }
+
+      memcpy(output + y * rowLen, src + y * rowLen, begin);
+      memcpy(output + y * rowLen + begin + len, src + y * rowLen + begin + len,
+             rowLen - begin - len);
+      unsigned char *dst = output + y * rowLen + begin;
+      const float *o = s.out.data();
+#pragma omp simd
+      for (int j = 0; j < len; j++) {
+        dst[j] = static_cast<unsigned char>(
+            std::min(std::max(static_cast<int>(o[j]), 0), 255));
+      }
+      if (channels == 4) {
+        const unsigned char *in = src + y * rowLen + begin;
+        for (int j = 3; j < len; j += 4) {
+          dst[j] = in[j];
+        }
+      }
+    }
+  });
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelJit(const Image &img, const Kernel &kernel, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelJit(img, kernel, executor);
+}
@@ -0,0 +1,145 @@
+#include "include/lut_kernel.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+namespace {
+constexpr int MAX_FRACTION_BITS = 16;
+
+void lutRowScalar(const unsigned char *row, int rowLen,
+                  const LutKernel &kernel, int channels, int32_t *acc,
+                  int len) {
+  std::fill(acc, acc + len, 0);
+  for (const auto &tap : kernel.taps) {
+    const unsigned char *p = row + tap.dy * rowLen + tap.dx * channels;
+    const int32_t *table = tap.table.data();
+    for (int j = 0; j < len; j++) {
+      acc[j] += table[p[j]];
+    }
+  }
+}
+
+__attribute__((target("avx2"))) void
+lutRowAvx2(const unsigned char *row, int rowLen, const LutKernel &kernel,
+           int channels, int32_t *acc, int len) {
+  int j = 0;
+  for (; j + 8 <= len; j += 8) {
+    __m256i sum = _mm256_setzero_si256();
+    for (const auto &tap : kernel.taps) {
+      const unsigned char *p = row + tap.dy * rowLen + tap.dx * channels + j;
+      __m256i index = _mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+      sum = _mm256_add_epi32(
+          sum, _mm256_i32gather_epi32(tap.table.data(), index, 4));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + j), sum);
+  }
+  for (; j < len; j++) {
+    int32_t sum = 0;
+    for (const auto &tap : kernel.taps) {
+      sum += tap.table[row[tap.dy * rowLen + tap.dx * channels + j]];
+    }
+    acc[j] = sum;
+  }
+}
+} // namespace
+
+LutKernel LutKernel::compile(const Kernel &kernel) {
+  LutKernel result;
+  result.size = kernel.size();
+  const int kHalf = result.size / 2;
+
+  double absSum = 0.0;
+  for (const auto &row : kernel) {
+    for (float value : row) {
+      absSum += std::fabs(value);
+    }
+  }
+  // 255 * sum|c| * 2^bits must stay below 2^31
+  result.fractionBits = MAX_FRACTION_BITS;
+  while (result.fractionBits > 0 &&
+         255.0 * absSum * std::ldexp(1.0, result.fractionBits) >=
+             2147483647.0) {
+    result.fractionBits--;
+  }
+
+  const double scale = std::ldexp(1.0, result.fractionBits);
+  for (int ky = 0; ky < result.size; ky++) {
+    for (int kx = 0; kx < result.size; kx++) {
+      float coefficient = kernel[ky][kx];
+      if (coefficient == 0.0f) {
+        continue;
+      }
+      Tap tap;
+      tap.dy = ky - kHalf;
+      tap.dx = kx - kHalf;
+      for (int v = 0; v < 256; v++) {
+        tap.table[v] =
+            static_cast<int32_t>(std::lround(coefficient * v * scale));
+      }
+      result.taps.push_back(tap);
+    }
+  }
+  return result;
+}
+
+Image applyKernelLut(const Image &img, const LutKernel &kernel,
+                     Executor &executor) {
+  static const bool gather = __builtin_cpu_supports("avx2");
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  const int kHalf = kernel.size / 2;
+  const int shift = kernel.fractionBits;
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[width * height * channels];
+  // Border rows here, border columns by the worker owning each row (see
+  // applyKernelSparse)
+  memcpy(output, src, kHalf * rowLen);
+  memcpy(output + (height - kHalf) * rowLen, src + (height - kHalf) * rowLen,
+         kHalf * rowLen);
+
+  const int begin = kHalf * channels;
+  const int len = (width - 2 * kHalf) * channels;
+
+  std::vector<std::vector<int32_t>> scratch(executor.workers());
+  executor.parallelFor(height - 2 * kHalf, [&](int task, int worker) {
+    std::vector<int32_t> &acc = scratch[worker];
+    if (acc.empty()) {
+      acc.resize(len);
+    }
+    const int y = kHalf + task;
+    memcpy(output + y * rowLen, src + y * rowLen, begin);
+    memcpy(output + y * rowLen + begin + len, src + y * rowLen + begin + len,
+           rowLen - begin - len);
+    const unsigned char *row = src + y * rowLen + begin;
+    if (gather) {
+      lutRowAvx2(row, rowLen, kernel, channels, acc.data(), len);
+    } else {
+      lutRowScalar(row, rowLen, kernel, channels, acc.data(), len);
+    }
+    unsigned char *out = output + y * rowLen + begin;
+    const int32_t *a = acc.data();
+#pragma omp simd
+    for (int j = 0; j < len; j++) {
+      out[j] = static_cast<unsigned char>(
+          std::min(std::max(a[j] >> shift, 0), 255));
+    }
+    if (channels == 4) {
+      for (int j = 3; j < len; j += 4) {
+        out[j] = row[j];
+      }
+    }
+  });
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelLut(const Image &img, const LutKernel &kernel, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelLut(img, kernel, executor);
+}
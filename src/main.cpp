@@ -1,12 +1,28 @@
 #include <cstdlib>
 #ifndef USE_MPI
+#include <filesystem>
 #include <limits>
 #endif
+#ifdef USE_MPI
 #include <mpi.h>
+#endif
 #include <iostream>
 #include "include/image.h"
 #include "include/stb_image_write.h"
 #include "include/image_processing.h"
+#include "include/convolution.h"
+#ifdef USE_MPI
+#include "include/distributed.h"
+#endif
+#include "include/kernel_decomposition.h"
+#include "include/gaussian.h"
+#include "include/processing_context.h"
+#include "include/thread_policy.h"
+#include "include/unsharp_mask.h"
+#ifndef USE_MPI
+#include "include/batch_processor.h"
+#include "include/pipeline.h"
+#endif
 
 using namespace std;
 
@@ -21,14 +37,14 @@ string getFileExtension(const string &fileName) {
 
 #ifdef USE_MPI
 int main(int argc, char *argv[]) {
-  const char *inputFile = "./examples/lena.png";
-  const char *outputFile = "./outputs/lena_modified.png";
+  const char *inputFile = argc > 1 ? argv[1] : "./examples/lena.png";
+  const char *outputFile =
+      argc > 2 ? argv[2] : "./outputs/lena_modified.png";
 
   MPI_Init(&argc, &argv);
 
-  int rank, size;
+  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
 
   Image img;
   Kernel kernel = kernels[Filter::LowPass3x3];
@@ -44,52 +60,46 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  // Broadcast image dimensions and channels to all processes
-  MPI_Bcast(&img.width, 1, MPI_INT, 0, MPI_COMM_WORLD);
-  MPI_Bcast(&img.height, 1, MPI_INT, 0, MPI_COMM_WORLD);
-  MPI_Bcast(&img.channels, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-  int extra = kernel.size() / 2;
-
-  // Calculate the stripe height per process
-  int rows_per_process = img.height / size;
-  int num_elements = (rows_per_process + extra) * img.width * img.channels;
-
-  // Allocate memory for each sub-image
-  unsigned char *sub_image_data = new unsigned char[num_elements];
-
-  // Scatter the image data
-  MPI_Scatter(img.data.get(), num_elements, MPI_UNSIGNED_CHAR, sub_image_data,
-              num_elements, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-
-  Image local_sub_image(sub_image_data, img.width, (rows_per_process + extra),
-                        img.channels);
-#ifdef OPENMP
-  Image processed_sub_image = applyKernelOpenMp(local_sub_image, kernel, 7);
-#else
-  Image processed_sub_image = applyKernelSeq(local_sub_image, kernel);
-#endif
-
-  // Gather processed sub-images back to the root
-  unsigned char *output_data = nullptr;
-  if (rank == 0) {
-    output_data = new unsigned char[img.width * img.height * img.channels];
+  // Every rank sees the same sizes, so all of them fail alike
+  ThreadDecision decision;
+  ProcessGrid grid;
+  DistributedTimings timings;
+  Image finalOutput;
+  try {
+    finalOutput = convolveDistributed(img, kernel, MPI_COMM_WORLD, &decision,
+                                      &grid, &timings);
+  } catch (const std::runtime_error &e) {
+    if (rank == 0) {
+      cerr << "Error: " << e.what() << endl;
+    }
+    MPI_Finalize();
+    return EXIT_FAILURE;
   }
 
-  num_elements -= img.width * img.channels;
-
-  MPI_Gather(processed_sub_image.data.get() + (img.width * img.channels),
-             num_elements, MPI_UNSIGNED_CHAR, output_data, num_elements,
-             MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
-
-  Image finalOutput = Image(output_data, img.width, img.height, img.channels);
-  finalOutput.save(outputFile, "jpg");
+  int status = EXIT_SUCCESS;
   if (rank == 0) {
-    cout << "Filtering completed and image saved to: " << outputFile << endl;
+    cout << "Split into " << grid.rows << " x " << grid.cols
+         << (grid.cols == 1 ? " row stripes" : " blocks") << endl;
+    cout << decision.report() << endl;
+    cout << "Scatter " << timings.scatterSeconds << " s, filter "
+         << timings.overlappedSeconds << " s overlapped + "
+         << timings.boundarySeconds << " s boundary, gather "
+         << timings.gatherSeconds << " s" << endl;
+    cout << "Halos " << timings.haloSeconds << " s in flight, "
+         << timings.hiddenSeconds() << " s hidden behind filtering, "
+         << timings.haloWaitSeconds << " s waited" << endl;
+    string fileExtension = getFileExtension(outputFile);
+    if (finalOutput.save(outputFile, fileExtension.c_str())) {
+      cout << "Filtering completed and image saved to: " << outputFile
+           << endl;
+    } else {
+      cerr << "Failed to save image as " << fileExtension << endl;
+      status = EXIT_FAILURE;
+    }
   }
 
   MPI_Finalize();
-  return EXIT_SUCCESS;
+  return status;
 }
 
 #else
@@ -109,20 +119,88 @@ Kernel getCustomKernel() {
   return customKernel;
 };
 
+// Decoded images a directory batch may hold in memory at once
+const size_t BATCH_MEMORY_BUDGET = size_t(2) << 30;
+
+// Filters every image of inputDir into outputDir, several at a time, on
+// the batch scheduler or as a decode/filter/encode pipeline; params selects
+// the unsharp mask instead of the kernel
+void processDirectory(const string &inputDir, const string &outputDir,
+                      const Kernel &kernel, const UnsharpMaskParams *params,
+                      double opsPerSample, bool pipelined) {
+  vector<string> names;
+  vector<BatchItem> items;
+  long samples = 0;
+  for (const auto &entry : filesystem::directory_iterator(inputDir)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+    try {
+      items.push_back(fileItem(entry.path().string()));
+    } catch (const runtime_error &) {
+      // Not an image
+      continue;
+    }
+    names.push_back(entry.path().filename().string());
+    samples += items.back().bytes;
+  }
+  filesystem::create_directories(outputDir);
+
+  // Workers are ThreadPool threads, which need no OpenMP
+  ThreadDecision decision = chooseThreadCount(samples, opsPerSample);
+  cout << decision.report() << endl;
+  auto filter = [&](Image &img, Executor &executor) {
+    if (params) {
+      return unsharpMask(img, *params, executor);
+    }
+    img.padReplication(kernel.size() / 2);
+    return convolve(img, kernel, executor);
+  };
+  auto save = [&](size_t index, Image &result) {
+    string path = (filesystem::path(outputDir) / names[index]).string();
+    if (!result.save(path.c_str(), getFileExtension(path).c_str())) {
+      throw runtime_error("Failed to save " + path);
+    }
+  };
+
+  if (pipelined) {
+    // One decoder keeps up with the filter; PNG deflate is slower, so about
+    // a quarter of the threads encode and the rest filter
+    PipelineOptions options;
+    options.encoders = max(1, decision.threads / 4);
+    options.filterThreads = max(1, decision.threads - options.encoders);
+    PipelineStats stats = runPipeline(items, filter, save, options);
+    cout << "Filtered " << stats.images << " images into " << outputDir
+         << " in " << stats.wallSeconds << " s (busy: decode "
+         << stats.decodeSeconds << " s, filter " << stats.filterSeconds
+         << " s, encode " << stats.encodeSeconds << " s)" << endl;
+    return;
+  }
+  BatchProcessor batch(decision.threads, BATCH_MEMORY_BUDGET);
+  batch.process(items, filter, save);
+  BatchStats stats = batch.stats();
+  cout << "Filtered " << stats.images << " images into " << outputDir
+       << ", at most " << stats.peakInFlight << " in memory at once" << endl;
+}
+
 int main() {
   // Variables for file paths
   string inputFile;
   string outputFile;
 
   // Read file paths from user
-  cout << "Enter the input image file path: ";
+  cout << "Enter the input image file path (or a directory): ";
   getline(cin, inputFile);
-  cout << "Enter the output image file path: ";
+  cout << "Enter the output image file path (a directory for batches): ";
   getline(cin, outputFile);
 
   try {
-    // Load and process the image
-    Image img = Image::load(inputFile.c_str());
+    // A directory is filtered as a batch once the filter is chosen
+    const bool batchMode = filesystem::is_directory(inputFile);
+    Image img;
+    if (!batchMode) {
+      img = Image::load(inputFile.c_str());
+    }
 
     int choice;
     cout << "Select a kernel option:\n";
@@ -131,14 +209,24 @@ int main() {
     cout << "3. High Pass 3x3\n";
     cout << "4. Gaussian\n";
     cout << "5. Input custom kernel\n";
-    cout << "Enter your choice (1-5): ";
+    cout << "6. Unsharp mask (sharpen)\n";
+    cout << "Enter your choice (1-6): ";
     cin >> choice;
 
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
     Kernel kernel;
+    Image outputImage;
+    UnsharpMaskParams params;
+    double opsPerSample;
 
-    if (choice == 5) {
+    if (choice == 6) {
+      cout << "Enter sigma, amount and threshold (e.g. 1.0 1.5 4): ";
+      cin >> params.sigma >> params.amount >> params.threshold;
+      cin.ignore(numeric_limits<streamsize>::max(), '\n');
+      // Two separable blur passes plus the sharpening combination
+      opsPerSample = 2.0 * gaussianKernel1D(params.sigma).size() + 3;
+    } else if (choice == 5) {
       kernel = getCustomKernel();
       // normalized the kernel
       long sum = 0;
@@ -152,19 +240,59 @@ int main() {
           x /= sum;
         }
       }
+      cout << "Kernel decomposition:\n"
+           << KernelDecomposition::analyze(kernel).report();
     } else if (choice < 5 && choice > 0) {
       kernel = kernels[static_cast<Filter>(choice - 1)];
     } else {
       std::cerr << "Invalid choice. Exiting.\n";
       return 1;
     }
+    if (choice != 6) {
+      opsPerSample = kernelOpsPerSample(kernel);
+    }
+    if (batchMode) {
+      int mode;
+      cout << "Select a batch mode:\n";
+      cout << "1. Shared scheduler (images and their tiles)\n";
+      cout << "2. Pipeline (decode, filter and encode overlap)\n";
+      cout << "Enter your choice (1-2): ";
+      cin >> mode;
+      cin.ignore(numeric_limits<streamsize>::max(), '\n');
+      processDirectory(inputFile, outputFile, kernel,
+                       choice == 6 ? &params : nullptr, opsPerSample,
+                       mode == 2);
+      return EXIT_SUCCESS;
+    }
 
-    img.padReplication(kernel.size() / 2);
-#ifdef OPENMP
-    Image outputImage = applyKernelOpenMp(img, kernel, 8);
-#else
-    Image outputImage = applyKernelSeq(img, kernel);
-#endif
+    ThreadDecision decision = chooseThreadCount(
+        static_cast<long>(img.width) * img.height * img.channels,
+        opsPerSample);
+    cout << decision.report() << endl;
+    // Across sockets, keep every worker on the rows whose pages it touched
+    const bool multiSocket = NumaTopology::system().nodes() > 1;
+    ProcessingContext context(decision.threads,
+                              multiSocket ? PoolSchedule::RowBands
+                                          : PoolSchedule::Dynamic);
+
+    if (choice == 6) {
+      outputImage = context.unsharpMask(img, params);
+    } else {
+      img.padReplication(kernel.size() / 2);
+      if (multiSocket) {
+        img = context.placeRowBands(img);
+      }
+      FlatTileStats stats;
+      ConvolutionOptions options;
+      options.skipFlatTiles = true;
+      options.flatTileStats = &stats;
+      outputImage = context.convolve(img, kernel, options);
+      // Only the sparse backend looks for flat tiles
+      if (stats.total > 0) {
+        cout << "Flat tiles skipped: " << stats.skipped << " of "
+             << stats.total << endl;
+      }
+    }
     string fileExtension = getFileExtension(outputFile);
 
     // Save the processed image
@@ -0,0 +1,371 @@
+#include "include/non_local_means.h"
+#include "include/image_processing.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr int TILE = 64;
+
+bool hasAvx2() {
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+}
+
+/**
+ * Geometry shared by every step of a tile. The tile is loaded with a halo of
+ * patchRadius + searchRadius pixels; squared differences are needed on the
+ * tile grown by patchRadius.
+ */
+struct TileGeometry {
+  int channels;
+  int th, tw;        // tile size
+  int halo;          // patchRadius + searchRadius
+  int search;        // searchRadius
+  int patch;         // 2 * patchRadius + 1
+  int lh, lw;        // local (tile + halo) size
+  int rh, rw;        // squared difference region size
+  float invNorm;     // 1 / (patch area * channels)
+  float noiseOffset; // 2 * sigma^2
+  float invH2;       // 1 / h^2
+};
+
+struct Scratch {
+  std::vector<float> local;    // planar, channels x lh x lw
+  std::vector<float> diff;     // rw
+  std::vector<float> integral; // (rh + 1) x (rw + 1)
+};
+
+void squaredDiffRowScalar(const float *const *a, const float *const *b,
+                          int channels, float *out, int n) {
+  for (int j = 0; j < n; j++) {
+    float sum = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      float d = a[c][j] - b[c][j];
+      sum += d * d;
+    }
+    out[j] = sum;
+  }
+}
+
+void addRowScalar(const float *prev, float *row, int n) {
+  for (int j = 0; j < n; j++) {
+    row[j] += prev[j];
+  }
+}
+
+void accumulateRowScalar(const TileGeometry &g, const float *top,
+                         const float *bottom, const float *const *shifted,
+                         float *wsum, float *const *vsum) {
+  const int p = g.patch;
+  for (int x = 0; x < g.tw; x++) {
+    float s = bottom[x + p] - top[x + p] - bottom[x] + top[x];
+    float d = std::max(s * g.invNorm - g.noiseOffset, 0.0f);
+    float w = std::exp(-d * g.invH2);
+    wsum[x] += w;
+    for (int c = 0; c < g.channels; c++) {
+      vsum[c][x] += w * shifted[c][x];
+    }
+  }
+}
+
+// exp(x) for x <= 0 with a Cephes-style polynomial, about 1 ulp accurate
+__attribute__((target("avx2,fma"))) inline __m256 exp256(__m256 x) {
+  x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                              _mm256_set1_ps(0.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+  y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+  __m256i n = _mm256_cvttps_epi32(fx);
+  n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+__attribute__((target("avx2,fma"))) void
+squaredDiffRowAvx2(const float *const *a, const float *const *b, int channels,
+                   float *out, int n) {
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int c = 0; c < channels; c++) {
+      __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a[c] + j),
+                               _mm256_loadu_ps(b[c] + j));
+      sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    _mm256_storeu_ps(out + j, sum);
+  }
+  for (; j < n; j++) {
+    float sum = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      float d = a[c][j] - b[c][j];
+      sum = std::fma(d, d, sum);
+    }
+    out[j] = sum;
+  }
+}
+
+__attribute__((target("avx2,fma"))) void addRowAvx2(const float *prev,
+                                                    float *row, int n) {
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    _mm256_storeu_ps(row + j, _mm256_add_ps(_mm256_loadu_ps(row + j),
+                                            _mm256_loadu_ps(prev + j)));
+  }
+  for (; j < n; j++) {
+    row[j] += prev[j];
+  }
+}
+
+// Weights of the patch distance sums `s`
+__attribute__((target("avx2,fma"))) inline __m256
+weights256(const TileGeometry &g, __m256 s) {
+  __m256 d = _mm256_max_ps(
+      _mm256_fmsub_ps(s, _mm256_set1_ps(g.invNorm),
+                      _mm256_set1_ps(g.noiseOffset)),
+      _mm256_setzero_ps());
+  return exp256(_mm256_mul_ps(d, _mm256_set1_ps(-g.invH2)));
+}
+
+__attribute__((target("avx2,fma"))) void
+accumulateRowAvx2(const TileGeometry &g, const float *top, const float *bottom,
+                  const float *const *shifted, float *wsum,
+                  float *const *vsum) {
+  const int p = g.patch;
+  int x = 0;
+  for (; x + 8 <= g.tw; x += 8) {
+    __m256 s = _mm256_sub_ps(_mm256_loadu_ps(bottom + x + p),
+                             _mm256_loadu_ps(top + x + p));
+    s = _mm256_sub_ps(s, _mm256_loadu_ps(bottom + x));
+    s = _mm256_add_ps(s, _mm256_loadu_ps(top + x));
+    __m256 w = weights256(g, s);
+    _mm256_storeu_ps(wsum + x, _mm256_add_ps(_mm256_loadu_ps(wsum + x), w));
+    for (int c = 0; c < g.channels; c++) {
+      __m256 v = _mm256_fmadd_ps(w, _mm256_loadu_ps(shifted[c] + x),
+                                 _mm256_loadu_ps(vsum[c] + x));
+      _mm256_storeu_ps(vsum[c] + x, v);
+    }
+  }
+  // The same arithmetic one lane at a time, so a pixel's result does not
+  // depend on where its row's vectors end
+  for (; x < g.tw; x++) {
+    float s = bottom[x + p] - top[x + p] - bottom[x] + top[x];
+    float w = _mm256_cvtss_f32(weights256(g, _mm256_set1_ps(s)));
+    wsum[x] += w;
+    for (int c = 0; c < g.channels; c++) {
+      vsum[c][x] = std::fma(w, shifted[c][x], vsum[c][x]);
+    }
+  }
+}
+
+// Copies the tile and its halo to planar floats, replicating image edges
+void loadTile(const Image &img, const TileGeometry &g, int y0, int x0,
+              Scratch &scratch) {
+  scratch.local.resize(static_cast<size_t>(g.channels) * g.lh * g.lw);
+  for (int i = 0; i < g.lh; i++) {
+    int sy = clamp(y0 - g.halo + i, 0, img.height - 1);
+    const unsigned char *row =
+        img.data.get() + static_cast<size_t>(sy) * img.width * img.channels;
+    for (int j = 0; j < g.lw; j++) {
+      int sx = clamp(x0 - g.halo + j, 0, img.width - 1);
+      for (int c = 0; c < g.channels; c++) {
+        scratch.local[(c * g.lh + i) * g.lw + j] = row[sx * g.channels + c];
+      }
+    }
+  }
+}
+
+/**
+ * Adds the contributions of offsets [first, last) to the accumulators of a
+ * tile: acc holds the weight sums followed by one weighted value plane per
+ * channel, each th x tw.
+ */
+void accumulateTile(const TileGeometry &g,
+                    const std::vector<std::pair<int, int>> &offsets,
+                    int first, int last, bool avx2, Scratch &scratch,
+                    float *acc) {
+  const int iw = g.rw + 1;
+  const size_t plane = static_cast<size_t>(g.lh) * g.lw;
+  scratch.diff.resize(g.rw);
+  scratch.integral.assign(static_cast<size_t>(g.rh + 1) * iw, 0.0f);
+  std::vector<const float *> a(g.channels), b(g.channels), shifted(g.channels);
+  std::vector<float *> vsum(g.channels);
+  const float *local = scratch.local.data();
+  float *integral = scratch.integral.data();
+
+  for (int o = first; o < last; o++) {
+    const int dy = offsets[o].first;
+    const int dx = offsets[o].second;
+
+    // Integral image of the squared differences for this offset
+    for (int i = 0; i < g.rh; i++) {
+      for (int c = 0; c < g.channels; c++) {
+        a[c] = local + c * plane + (i + g.search) * g.lw + g.search;
+        b[c] = local + c * plane + (i + g.search + dy) * g.lw + g.search + dx;
+      }
+      if (avx2) {
+        squaredDiffRowAvx2(a.data(), b.data(), g.channels,
+                           scratch.diff.data(), g.rw);
+      } else {
+        squaredDiffRowScalar(a.data(), b.data(), g.channels,
+                             scratch.diff.data(), g.rw);
+      }
+      float *row = integral + (i + 1) * iw;
+      float prefix = 0.0f;
+      for (int j = 0; j < g.rw; j++) {
+        prefix += scratch.diff[j];
+        row[j + 1] = prefix;
+      }
+      if (avx2) {
+        addRowAvx2(row - iw, row, iw);
+      } else {
+        addRowScalar(row - iw, row, iw);
+      }
+    }
+
+    // Patch distances, weights and weighted sums for every tile pixel
+    for (int y = 0; y < g.th; y++) {
+      const float *top = integral + y * iw;
+      const float *bottom = integral + (y + g.patch) * iw;
+      float *wsum = acc + y * g.tw;
+      for (int c = 0; c < g.channels; c++) {
+        shifted[c] =
+            local + c * plane + (y + g.halo + dy) * g.lw + g.halo + dx;
+        vsum[c] = acc + (c + 1) * g.th * g.tw + y * g.tw;
+      }
+      if (avx2) {
+        accumulateRowAvx2(g, top, bottom, shifted.data(), wsum, vsum.data());
+      } else {
+        accumulateRowScalar(g, top, bottom, shifted.data(), wsum,
+                            vsum.data());
+      }
+    }
+  }
+}
+
+void writeTile(const TileGeometry &g, const float *acc, int y0, int x0,
+               int width, unsigned char *output) {
+  for (int y = 0; y < g.th; y++) {
+    unsigned char *out =
+        output + (static_cast<size_t>(y0 + y) * width + x0) * g.channels;
+    for (int x = 0; x < g.tw; x++) {
+      float inv = 1.0f / acc[y * g.tw + x];
+      for (int c = 0; c < g.channels; c++) {
+        float v = acc[(c + 1) * g.th * g.tw + y * g.tw + x] * inv;
+        out[x * g.channels + c] = static_cast<unsigned char>(
+            std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+      }
+    }
+  }
+}
+} // namespace
+
+Image nonLocalMeans(const Image &img, const NonLocalMeansParams &params,
+                    Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int search = params.searchRadius;
+  const int patchRadius = params.patchRadius;
+  const bool avx2 = params.simd && hasAvx2();
+
+  std::vector<std::pair<int, int>> offsets;
+  for (int dy = -search; dy <= search; dy++) {
+    for (int dx = -search; dx <= search; dx++) {
+      offsets.emplace_back(dy, dx);
+    }
+  }
+  const int numOffsets = offsets.size();
+
+  const int tilesY = (height + TILE - 1) / TILE;
+  const int tilesX = (width + TILE - 1) / TILE;
+  const int numTiles = tilesY * tilesX;
+  const int nthreads = executor.workers();
+  // Split the offsets of each tile in groups when tiles alone cannot keep
+  // every thread busy; partial sums are then reduced per tile.
+  const int groups = numTiles >= 4 * nthreads
+                         ? 1
+                         : std::min(numOffsets, (4 * nthreads + numTiles - 1) /
+                                                    numTiles);
+  const int numItems = numTiles * groups;
+
+  auto geometry = [&](int tile) {
+    TileGeometry g;
+    g.channels = channels;
+    g.th = std::min(TILE, height - (tile / tilesX) * TILE);
+    g.tw = std::min(TILE, width - (tile % tilesX) * TILE);
+    g.halo = patchRadius + search;
+    g.search = search;
+    g.patch = 2 * patchRadius + 1;
+    g.lh = g.th + 2 * g.halo;
+    g.lw = g.tw + 2 * g.halo;
+    g.rh = g.th + 2 * patchRadius;
+    g.rw = g.tw + 2 * patchRadius;
+    g.invNorm = 1.0f / (g.patch * g.patch * channels);
+    g.noiseOffset = 2.0f * params.sigma * params.sigma;
+    g.invH2 = 1.0f / (params.h * params.h);
+    return g;
+  };
+
+  unsigned char *output = new unsigned char[width * height * channels];
+  std::vector<std::vector<float>> partials(groups > 1 ? numItems : 0);
+
+  struct Buffers {
+    Scratch scratch;
+    std::vector<float> acc;
+  };
+  std::vector<Buffers> buffers(nthreads);
+  executor.parallelFor(numItems, [&](int item, int worker) {
+    Scratch &scratch = buffers[worker].scratch;
+    std::vector<float> &acc = buffers[worker].acc;
+    const int tile = item / groups;
+    const int group = item % groups;
+    const int y0 = (tile / tilesX) * TILE;
+    const int x0 = (tile % tilesX) * TILE;
+    TileGeometry g = geometry(tile);
+
+    acc.assign(static_cast<size_t>(channels + 1) * g.th * g.tw, 0.0f);
+    loadTile(img, g, y0, x0, scratch);
+    accumulateTile(g, offsets, group * numOffsets / groups,
+                   (group + 1) * numOffsets / groups, avx2, scratch,
+                   acc.data());
+    if (groups == 1) {
+      writeTile(g, acc.data(), y0, x0, width, output);
+    } else {
+      partials[item] = acc;
+    }
+  });
+
+  if (groups > 1) {
+    executor.parallelFor(numTiles, [&](int tile, int) {
+      std::vector<float> &sum = partials[tile * groups];
+      for (int group = 1; group < groups; group++) {
+        const std::vector<float> &part = partials[tile * groups + group];
+        for (size_t i = 0; i < sum.size(); i++) {
+          sum[i] += part[i];
+        }
+      }
+      writeTile(geometry(tile), sum.data(), (tile / tilesX) * TILE,
+                (tile % tilesX) * TILE, width, output);
+    });
+  }
+  return Image(output, width, height, channels);
+}
+
+Image nonLocalMeans(const Image &img, const NonLocalMeansParams &params,
+                    int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return nonLocalMeans(img, params, executor);
+}
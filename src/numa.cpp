@@ -0,0 +1,227 @@
+#include "include/numa.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// From <linux/mempolicy.h>
+constexpr int MPOL_INTERLEAVE_MODE = 3;
+// Largest node id the interleave mask covers
+constexpr int MAX_NODES = 1024;
+
+std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+// Ids of the node<N> entries in sysfs, sorted
+std::vector<int> nodeIds() {
+  std::vector<int> ids;
+#ifdef __linux__
+  if (DIR *dir = opendir("/sys/devices/system/node")) {
+    while (dirent *entry = readdir(dir)) {
+      int id;
+      char rest;
+      if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1 && id >= 0) {
+        ids.push_back(id);
+      }
+    }
+    closedir(dir);
+  }
+#endif
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+std::vector<std::vector<int>> readNodeCpus() {
+  std::vector<int> allowed = allowedCpus();
+  std::vector<std::vector<int>> nodes;
+  for (int id : nodeIds()) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) +
+                       "/cpulist");
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> cpus;
+    for (int cpu : parseCpuList(list)) {
+      if (allowed.empty() ||
+          std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+        cpus.push_back(cpu);
+      }
+    }
+    // Memory-only nodes and nodes outside the affinity mask run no worker
+    if (!cpus.empty()) {
+      nodes.push_back(cpus);
+    }
+  }
+  if (nodes.empty()) {
+    if (allowed.empty()) {
+      allowed.push_back(0);
+    }
+    nodes.push_back(allowed);
+  }
+  return nodes;
+}
+
+size_t pageSize() {
+#ifdef __linux__
+  return sysconf(_SC_PAGESIZE);
+#else
+  return 4096;
+#endif
+}
+} // namespace
+
+std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    int first, last;
+    if (sscanf(item.c_str(), "%d-%d", &first, &last) == 2) {
+      for (int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } else if (sscanf(item.c_str(), "%d", &first) == 1) {
+      cpus.push_back(first);
+    }
+  }
+  return cpus;
+}
+
+NumaTopology::NumaTopology(std::vector<std::vector<int>> nodeCpus)
+    : nodeCpus(std::move(nodeCpus)) {
+  if (this->nodeCpus.empty()) {
+    throw std::runtime_error("NUMA topology without nodes");
+  }
+}
+
+const NumaTopology &NumaTopology::system() {
+  static const NumaTopology topology(readNodeCpus());
+  return topology;
+}
+
+int NumaTopology::totalCpus() const {
+  int total = 0;
+  for (const std::vector<int> &cpus : nodeCpus) {
+    total += cpus.size();
+  }
+  return total;
+}
+
+std::vector<int> NumaTopology::workerNodes(int nthreads) const {
+  std::vector<int> result(std::max(0, nthreads));
+  const int total = totalCpus();
+  int node = 0;
+  // CPUs of the nodes before `node` plus `node` itself
+  int through = nodeCpus[0].size();
+  for (int worker = 0; worker < nthreads; worker++) {
+    // Position of the worker's share on the CPU axis
+    const long position = static_cast<long>(worker) * total / nthreads;
+    while (position >= through && node + 1 < nodes()) {
+      node++;
+      through += nodeCpus[node].size();
+    }
+    result[worker] = node;
+  }
+  return result;
+}
+
+std::vector<int> NumaTopology::workerCpus(int nthreads) const {
+  std::vector<int> nodesOfWorkers = workerNodes(nthreads);
+  std::vector<int> used(nodes(), 0);
+  std::vector<int> result;
+  for (int node : nodesOfWorkers) {
+    const std::vector<int> &cpus = nodeCpus[node];
+    result.push_back(cpus[used[node]++ % cpus.size()]);
+  }
+  return result;
+}
+
+unsigned char *numaAllocate(size_t bytes, NumaPlacement placement) {
+#ifdef __linux__
+  // One leading page records the mapping size for numaFree()
+  const size_t page = pageSize();
+  const size_t length = page + (bytes + page - 1) / page * page;
+  void *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("mmap of image buffer failed");
+  }
+  unsigned char *base = static_cast<unsigned char *>(mapping);
+  memcpy(base, &length, sizeof(length));
+  if (placement == NumaPlacement::Interleave && length > page) {
+    constexpr int BITS = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(MAX_NODES / BITS);
+    int maxNode = 0;
+    for (int id : nodeIds()) {
+      if (id < MAX_NODES) {
+        mask[id / BITS] |= 1ul << (id % BITS);
+        maxNode = std::max(maxNode, id);
+      }
+    }
+    // Interleaving over a single node changes nothing
+    if (maxNode > 0) {
+      // Best effort: a refused policy leaves the default placement
+      syscall(SYS_mbind, base + page, length - page, MPOL_INTERLEAVE_MODE,
+              mask.data(), static_cast<unsigned long>(maxNode + 2), 0);
+    }
+  }
+  return base + page;
+#else
+  (void)placement;
+  unsigned char *data = new unsigned char[bytes];
+  return data;
+#endif
+}
+
+void numaFree(unsigned char *data) {
+  if (!data) {
+    return;
+  }
+#ifdef __linux__
+  unsigned char *base = data - pageSize();
+  size_t length;
+  memcpy(&length, base, sizeof(length));
+  munmap(base, length);
+#else
+  delete[] data;
+#endif
+}
+
+Image numaImage(int width, int height, int channels, NumaPlacement placement) {
+  const size_t bytes = static_cast<size_t>(width) * height * channels;
+  return Image(numaAllocate(bytes, placement), width, height, channels,
+               numaFree);
+}
+
+Image placeRowBands(const Image &img, Executor &executor,
+                    NumaPlacement placement) {
+  Image result = numaImage(img.width, img.height, img.channels, placement);
+  const size_t rowLen = static_cast<size_t>(img.width) * img.channels;
+  executor.parallelFor(img.height, [&](int y, int) {
+    memcpy(result.data.get() + y * rowLen, img.data.get() + y * rowLen,
+           rowLen);
+  });
+  return result;
+}
@@ -0,0 +1,159 @@
+#include "include/pipeline.h"
+#include "include/thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <immintrin.h>
+#include <mutex>
+#include <thread>
+
+namespace {
+// Backoff rounds spent pausing, then yielding, before sleeping
+constexpr int PAUSE_ROUNDS = 16;
+constexpr int YIELD_ROUNDS = 64;
+constexpr auto SLEEP = std::chrono::microseconds(100);
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Job {
+  size_t index = 0;
+  Image image;
+};
+} // namespace
+
+void queueBackoff(int round) {
+  if (round < PAUSE_ROUNDS) {
+    _mm_pause();
+  } else if (round < YIELD_ROUNDS) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(SLEEP);
+  }
+}
+
+PipelineStats runPipeline(const std::vector<BatchItem> &items,
+                          const BatchProcessor::Filter &filter,
+                          const BatchProcessor::Sink &sink,
+                          const PipelineOptions &options) {
+  const Clock::time_point start = Clock::now();
+  const int decoders = std::max(1, options.decoders);
+  const int filterWorkers = std::max(1, options.filterWorkers);
+  const int encoders = std::max(1, options.encoders);
+  BoundedQueue<Job> decoded(std::max(1, options.queueCapacity));
+  BoundedQueue<Job> filtered(std::max(1, options.queueCapacity));
+
+  std::atomic<size_t> nextItem{0};
+  std::atomic<int> decodersLeft{decoders};
+  std::atomic<int> filterWorkersLeft{filterWorkers};
+  std::atomic<bool> aborted{false};
+  std::mutex mutex;
+  std::exception_ptr error;
+  PipelineStats stats;
+
+  auto fail = [&] {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+    aborted = true;
+    decoded.close();
+    filtered.close();
+  };
+  auto addBusy = [&](double PipelineStats::*stage, double seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.*stage += seconds;
+  };
+
+  auto decode = [&] {
+    double busy = 0;
+    try {
+      for (size_t i = nextItem++; i < items.size() && !aborted;
+           i = nextItem++) {
+        const Clock::time_point begin = Clock::now();
+        Job job;
+        job.index = i;
+        job.image = items[i].load();
+        busy += secondsSince(begin);
+        if (!decoded.push(job)) {
+          break;
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+    addBusy(&PipelineStats::decodeSeconds, busy);
+    if (--decodersLeft == 0) {
+      decoded.close();
+    }
+  };
+
+  auto filterStage = [&] {
+    double busy = 0;
+    try {
+      ThreadPool pool(options.filterThreads, false);
+      Job job;
+      while (!aborted && decoded.pop(job)) {
+        const Clock::time_point begin = Clock::now();
+        Job result;
+        result.index = job.index;
+        result.image = filter(job.image, pool);
+        // Release the input before waiting for the encoders
+        job.image = Image();
+        busy += secondsSince(begin);
+        if (!filtered.push(result)) {
+          break;
+        }
+      }
+    } catch (...) {
+      fail();
+    }
+    addBusy(&PipelineStats::filterSeconds, busy);
+    if (--filterWorkersLeft == 0) {
+      filtered.close();
+    }
+  };
+
+  auto encode = [&] {
+    double busy = 0;
+    int encoded = 0;
+    try {
+      Job job;
+      while (!aborted && filtered.pop(job)) {
+        const Clock::time_point begin = Clock::now();
+        sink(job.index, job.image);
+        job.image = Image();
+        busy += secondsSince(begin);
+        encoded++;
+      }
+    } catch (...) {
+      fail();
+    }
+    addBusy(&PipelineStats::encodeSeconds, busy);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.images += encoded;
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < decoders; i++) {
+    threads.emplace_back(decode);
+  }
+  for (int i = 0; i < filterWorkers; i++) {
+    threads.emplace_back(filterStage);
+  }
+  for (int i = 0; i < encoders; i++) {
+    threads.emplace_back(encode);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  stats.wallSeconds = secondsSince(start);
+  return stats;
+}
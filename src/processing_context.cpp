@@ -0,0 +1,65 @@
+#include "include/processing_context.h"
+#include "include/transpose.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+ProcessingContext::ProcessingContext(int nthreads, PoolSchedule schedule)
+    : pool(nthreads, true, schedule) {}
+
+ProcessingContext &ProcessingContext::shared(int nthreads) {
+  static std::mutex mutex;
+  static std::map<int, std::unique_ptr<ProcessingContext>> contexts;
+  nthreads = std::max(1, nthreads);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<ProcessingContext> &context = contexts[nthreads];
+  if (!context) {
+    context.reset(new ProcessingContext(nthreads));
+  }
+  return *context;
+}
+
+Image ProcessingContext::convolve(Image &img, const Kernel &kernel,
+                                  const ConvolutionOptions &options) {
+  return ::convolve(img, kernel, pool, options);
+}
+
+Image ProcessingContext::unsharpMask(const Image &img,
+                                     const UnsharpMaskParams &params) {
+  return ::unsharpMask(img, params, pool);
+}
+
+Image ProcessingContext::resize(const Image &img, int width, int height,
+                                ResampleFilter filter) {
+  return ::resize(img, width, height, filter, pool);
+}
+
+Image ProcessingContext::resizeAndBlur(const Image &img, int width,
+                                       int height, ResampleFilter filter,
+                                       float sigma) {
+  return ::resizeAndBlur(img, width, height, filter, sigma, pool);
+}
+
+Image ProcessingContext::guidedFilter(const Image &guide, const Image &input,
+                                      int radius, float epsilon) {
+  return ::guidedFilter(guide, input, radius, epsilon, pool);
+}
+
+Image ProcessingContext::nonLocalMeans(const Image &img,
+                                       const NonLocalMeansParams &params) {
+  return ::nonLocalMeans(img, params, pool);
+}
+
+Image ProcessingContext::transpose(const Image &img) {
+  return transposeImage(img, pool);
+}
+
+ImagePyramid ProcessingContext::pyramid(const Image &base, int levels) {
+  return ImagePyramid(base, levels, pool);
+}
+
+Image ProcessingContext::placeRowBands(const Image &img,
+                                       NumaPlacement placement) {
+  return ::placeRowBands(img, pool, placement);
+}
@@ -0,0 +1,199 @@
+#include "include/pyramid.h"
+#include "include/image_processing.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+// 5-tap binomial approximation of a Gaussian with sigma ~= 1
+constexpr float BINOMIAL[5] = {1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16,
+                               1.0f / 16};
+constexpr int PAD = 2;
+
+int levelCount(int width, int height) {
+  int count = 1;
+  while (width > 1 || height > 1) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    count++;
+  }
+  return count;
+}
+
+// Replicates the first and last pixel of a row padded by `pad` pixels
+void replicateEdges(float *padded, int width, int channels, int pad) {
+  for (int p = 0; p < pad; p++) {
+    for (int c = 0; c < channels; c++) {
+      padded[p * channels + c] = padded[pad * channels + c];
+      padded[(pad + width + p) * channels + c] =
+          padded[(pad + width - 1) * channels + c];
+    }
+  }
+}
+} // namespace
+
+FloatImage pyrDown(const FloatImage &img, Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  FloatImage result((width + 1) / 2, (height + 1) / 2, channels);
+  const int rowLen = width * channels;
+
+  std::vector<std::vector<float>> scratch(executor.workers());
+  executor.parallelFor(result.height, [&](int Y, int worker) {
+    std::vector<float> &padded = scratch[worker];
+    if (padded.empty()) {
+      padded.resize((width + 2 * PAD) * channels);
+    }
+    // Vertical taps around source row 2Y, written to a padded row
+    float *vrow = padded.data() + PAD * channels;
+    std::fill(vrow, vrow + rowLen, 0.0f);
+    for (int k = 0; k < 5; k++) {
+      const float w = BINOMIAL[k];
+      const float *src = img.row(clamp(2 * Y + k - PAD, 0, height - 1));
+#pragma omp simd
+      for (int j = 0; j < rowLen; j++) {
+        vrow[j] += w * src[j];
+      }
+    }
+    replicateEdges(padded.data(), width, channels, PAD);
+
+    // Horizontal taps, evaluated at even columns only
+    float *out = result.row(Y);
+    for (int X = 0; X < result.width; X++) {
+      const float *p = padded.data() + 2 * X * channels;
+      for (int c = 0; c < channels; c++) {
+        out[X * channels + c] =
+            BINOMIAL[0] * p[c] + BINOMIAL[1] * p[channels + c] +
+            BINOMIAL[2] * p[2 * channels + c] +
+            BINOMIAL[3] * p[3 * channels + c] +
+            BINOMIAL[4] * p[4 * channels + c];
+      }
+    }
+  });
+  return result;
+}
+
+FloatImage pyrDown(const FloatImage &img, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return pyrDown(img, executor);
+}
+
+FloatImage pyrUp(const FloatImage &img, int width, int height,
+                 Executor &executor) {
+  const int channels = img.channels;
+  const int rowLen = img.width * channels;
+  FloatImage result(width, height, channels);
+
+  std::vector<std::vector<float>> scratch(executor.workers());
+  executor.parallelFor(height, [&](int y, int worker) {
+    std::vector<float> &padded = scratch[worker];
+    if (padded.empty()) {
+      padded.resize((img.width + 2) * channels);
+    }
+    // Even rows take (1 6 1) / 8 of three coarse rows, odd rows average two
+    const int Y = y / 2;
+    float *vrow = padded.data() + channels;
+    const float *mid = img.row(clamp(Y, 0, img.height - 1));
+    const float *next = img.row(clamp(Y + 1, 0, img.height - 1));
+    if (y % 2 == 0) {
+      const float *prev = img.row(clamp(Y - 1, 0, img.height - 1));
+#pragma omp simd
+      for (int j = 0; j < rowLen; j++) {
+        vrow[j] = 0.125f * prev[j] + 0.75f * mid[j] + 0.125f * next[j];
+      }
+    } else {
+#pragma omp simd
+      for (int j = 0; j < rowLen; j++) {
+        vrow[j] = 0.5f * (mid[j] + next[j]);
+      }
+    }
+    replicateEdges(padded.data(), img.width, channels, 1);
+
+    float *out = result.row(y);
+    for (int x = 0; x < width; x++) {
+      const float *p = vrow + (x / 2) * channels;
+      for (int c = 0; c < channels; c++) {
+        out[x * channels + c] =
+            x % 2 == 0 ? 0.125f * p[c - channels] + 0.75f * p[c] +
+                             0.125f * p[c + channels]
+                       : 0.5f * (p[c] + p[c + channels]);
+      }
+    }
+  });
+  return result;
+}
+
+FloatImage pyrUp(const FloatImage &img, int width, int height, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return pyrUp(img, width, height, executor);
+}
+
+ImagePyramid::ImagePyramid(const Image &base, int levels, int nthreads)
+    : executor(&ProcessingContext::shared(nthreads).executor()) {
+  init(base, levels);
+}
+
+ImagePyramid::ImagePyramid(const Image &base, int levels, Executor &executor)
+    : executor(&executor) {
+  init(base, levels);
+}
+
+void ImagePyramid::init(const Image &base, int levels) {
+  int maxLevels = levelCount(base.width, base.height);
+  numLevels = levels <= 0 ? maxLevels : std::min(levels, maxLevels);
+  gaussianLevels.resize(numLevels);
+  laplacianLevels.resize(numLevels);
+  gaussianBuilt.reset(new std::once_flag[numLevels]);
+  laplacianBuilt.reset(new std::once_flag[numLevels]);
+  gaussianLevels[0] = FloatImage::fromImage(base);
+  std::call_once(gaussianBuilt[0], [] {});
+}
+
+const FloatImage &ImagePyramid::gaussian(int level) {
+  std::call_once(gaussianBuilt[level], [this, level] {
+    gaussianLevels[level] = pyrDown(gaussian(level - 1), *executor);
+  });
+  return gaussianLevels[level];
+}
+
+const FloatImage &ImagePyramid::laplacian(int level) {
+  std::call_once(laplacianBuilt[level], [this, level] {
+    const FloatImage &fine = gaussian(level);
+    if (level == numLevels - 1) {
+      laplacianLevels[level] = fine;
+      return;
+    }
+    FloatImage band =
+        pyrUp(gaussian(level + 1), fine.width, fine.height, *executor);
+    for (size_t i = 0; i < band.data.size(); i++) {
+      band.data[i] = fine.data[i] - band.data[i];
+    }
+    laplacianLevels[level] = std::move(band);
+  });
+  return laplacianLevels[level];
+}
+
+void ImagePyramid::buildAll() {
+  // Each Gaussian level depends on the previous one, so only the rows within
+  // a level can be processed in parallel.
+  for (int level = 1; level < numLevels; level++) {
+    gaussian(level);
+  }
+  // Laplacian levels are independent of each other
+  executor->parallelFor(numLevels,
+                        [this](int level, int) { laplacian(level); });
+}
+
+Image ImagePyramid::reconstruct() {
+  FloatImage current = laplacian(numLevels - 1);
+  for (int level = numLevels - 2; level >= 0; level--) {
+    const FloatImage &band = laplacian(level);
+    FloatImage up = pyrUp(current, band.width, band.height, *executor);
+    for (size_t i = 0; i < up.data.size(); i++) {
+      up.data[i] += band.data[i];
+    }
+    current = std::move(up);
+  }
+  return current.toImage();
+}
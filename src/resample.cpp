@@ -0,0 +1,237 @@
+#include "include/resample.h"
+#include "include/float_image.h"
+#include "include/gaussian.h"
+#include "include/image_processing.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+constexpr float PI = 3.14159265358979f;
+
+struct Footprint {
+  int start;
+  std::vector<float> weights;
+};
+
+float filterSupport(ResampleFilter filter) {
+  switch (filter) {
+  case ResampleFilter::Box:
+    return 0.5f;
+  case ResampleFilter::Bilinear:
+    return 1.0f;
+  case ResampleFilter::Bicubic:
+    return 2.0f;
+  case ResampleFilter::Lanczos3:
+    return 3.0f;
+  }
+  return 1.0f;
+}
+
+float filterValue(ResampleFilter filter, float x) {
+  float ax = std::fabs(x);
+  switch (filter) {
+  case ResampleFilter::Box:
+    return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+  case ResampleFilter::Bilinear:
+    return ax < 1.0f ? 1.0f - ax : 0.0f;
+  case ResampleFilter::Bicubic: {
+    const float a = -0.5f;
+    if (ax < 1.0f) {
+      return ((a + 2.0f) * ax - (a + 3.0f)) * ax * ax + 1.0f;
+    } else if (ax < 2.0f) {
+      return ((a * ax - 5.0f * a) * ax + 8.0f * a) * ax - 4.0f * a;
+    }
+    return 0.0f;
+  }
+  case ResampleFilter::Lanczos3:
+    if (ax < 1e-6f) {
+      return 1.0f;
+    } else if (ax < 3.0f) {
+      return 3.0f * std::sin(PI * x) * std::sin(PI * x / 3.0f) /
+             (PI * PI * x * x);
+    }
+    return 0.0f;
+  }
+  return 0.0f;
+}
+
+// Source footprint of every output sample, clamped to the source range
+std::vector<Footprint> footprints(int srcSize, int dstSize,
+                                  ResampleFilter filter) {
+  const float scale = static_cast<float>(srcSize) / dstSize;
+  const float filterScale = std::max(scale, 1.0f);
+  const float radius = filterSupport(filter) * filterScale;
+
+  std::vector<Footprint> result(dstSize);
+  for (int i = 0; i < dstSize; i++) {
+    const float center = (i + 0.5f) * scale;
+    int lo = static_cast<int>(std::floor(center - radius));
+    int hi = static_cast<int>(std::ceil(center + radius));
+    Footprint &fp = result[i];
+    fp.start = clamp(lo, 0, srcSize - 1);
+    fp.weights.assign(clamp(hi, 0, srcSize - 1) - fp.start + 1, 0.0f);
+
+    float sum = 0.0f;
+    for (int j = lo; j <= hi; j++) {
+      float w = filterValue(filter, (j + 0.5f - center) / filterScale);
+      fp.weights[clamp(j, 0, srcSize - 1) - fp.start] += w;
+      sum += w;
+    }
+    if (sum == 0.0f) {
+      // Degenerate footprint, fall back to the nearest sample
+      std::fill(fp.weights.begin(), fp.weights.end(), 0.0f);
+      fp.weights[clamp(static_cast<int>(center), fp.start,
+                       fp.start + static_cast<int>(fp.weights.size()) - 1) -
+                 fp.start] = 1.0f;
+      continue;
+    }
+    for (auto &w : fp.weights) {
+      w /= sum;
+    }
+  }
+  return result;
+}
+
+// Folds a blur applied over the output samples into the footprints
+std::vector<Footprint> applyBlur(const std::vector<Footprint> &base,
+                                 const std::vector<float> &blur) {
+  const int dstSize = base.size();
+  const int radius = blur.size() / 2;
+  std::vector<Footprint> result(dstSize);
+  for (int i = 0; i < dstSize; i++) {
+    int lo = base[i].start;
+    int hi = lo;
+    for (int k = -radius; k <= radius; k++) {
+      const Footprint &fp = base[clamp(i + k, 0, dstSize - 1)];
+      lo = std::min(lo, fp.start);
+      hi = std::max(hi, fp.start + static_cast<int>(fp.weights.size()) - 1);
+    }
+    Footprint &out = result[i];
+    out.start = lo;
+    out.weights.assign(hi - lo + 1, 0.0f);
+    for (int k = -radius; k <= radius; k++) {
+      const Footprint &fp = base[clamp(i + k, 0, dstSize - 1)];
+      for (size_t t = 0; t < fp.weights.size(); t++) {
+        out.weights[fp.start - lo + t] += blur[k + radius] * fp.weights[t];
+      }
+    }
+  }
+  return result;
+}
+
+// Runs the horizontal and the vertical pass of a separable resampling
+Image resampleSeparable(const Image &img, const ResampleWeights &horizontal,
+                        const ResampleWeights &vertical, int width,
+                        int height, Executor &executor) {
+  const int channels = img.channels;
+  const int srcRowLen = img.width * channels;
+  const int dstRowLen = width * channels;
+  const unsigned char *src = img.data.get();
+  FloatImage tmp(width, img.height, channels);
+
+  // Horizontal pass: every source row to the target width
+  std::vector<std::vector<float>> rows(executor.workers());
+  executor.parallelFor(img.height, [&](int y, int worker) {
+    std::vector<float> &row = rows[worker];
+    row.resize(srcRowLen);
+    const unsigned char *in = src + static_cast<size_t>(y) * srcRowLen;
+    for (int j = 0; j < srcRowLen; j++) {
+      row[j] = in[j];
+    }
+    float *out = tmp.row(y);
+    for (int x = 0; x < width; x++) {
+      const float *w = horizontal.weights.data() + x * horizontal.taps;
+      const float *p = row.data() + horizontal.start[x] * channels;
+      for (int c = 0; c < channels; c++) {
+        float acc = 0.0f;
+        for (int t = 0; t < horizontal.taps; t++) {
+          acc += w[t] * p[t * channels + c];
+        }
+        out[x * channels + c] = acc;
+      }
+    }
+  });
+
+  // Vertical pass: rows of the intermediate combined into output rows
+  unsigned char *output = new unsigned char[height * dstRowLen];
+  std::vector<std::vector<float>> accs(executor.workers());
+  executor.parallelFor(height, [&](int y, int worker) {
+    std::vector<float> &acc = accs[worker];
+    acc.resize(dstRowLen);
+    std::fill(acc.begin(), acc.end(), 0.0f);
+    float *a = acc.data();
+    for (int t = 0; t < vertical.taps; t++) {
+      const float w = vertical.weights[y * vertical.taps + t];
+      const float *in = tmp.row(vertical.start[y] + t);
+#pragma omp simd
+      for (int j = 0; j < dstRowLen; j++) {
+        a[j] += w * in[j];
+      }
+    }
+    unsigned char *out = output + static_cast<size_t>(y) * dstRowLen;
+#pragma omp simd
+    for (int j = 0; j < dstRowLen; j++) {
+      out[j] = static_cast<unsigned char>(
+          std::min(std::max(a[j], 0.0f), 255.0f) + 0.5f);
+    }
+  });
+  return Image(output, width, height, channels);
+}
+} // namespace
+
+ResampleWeights ResampleWeights::compute(int srcSize, int dstSize,
+                                         ResampleFilter filter,
+                                         const std::vector<float> &blur) {
+  std::vector<Footprint> fps = footprints(srcSize, dstSize, filter);
+  if (blur.size() > 1) {
+    fps = applyBlur(fps, blur);
+  }
+
+  ResampleWeights result;
+  for (const auto &fp : fps) {
+    result.taps = std::max(result.taps, static_cast<int>(fp.weights.size()));
+  }
+  result.start.resize(dstSize);
+  result.weights.assign(static_cast<size_t>(dstSize) * result.taps, 0.0f);
+  for (int i = 0; i < dstSize; i++) {
+    // Shift windows near the end left so all taps stay inside the source
+    const Footprint &fp = fps[i];
+    int start = std::min(fp.start, srcSize - result.taps);
+    result.start[i] = start;
+    for (size_t t = 0; t < fp.weights.size(); t++) {
+      result.weights[i * result.taps + fp.start - start + t] = fp.weights[t];
+    }
+  }
+  return result;
+}
+
+Image resize(const Image &img, int width, int height, ResampleFilter filter,
+             Executor &executor) {
+  return resampleSeparable(
+      img, ResampleWeights::compute(img.width, width, filter),
+      ResampleWeights::compute(img.height, height, filter), width, height,
+      executor);
+}
+
+Image resize(const Image &img, int width, int height, ResampleFilter filter,
+             int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return resize(img, width, height, filter, executor);
+}
+
+Image resizeAndBlur(const Image &img, int width, int height,
+                    ResampleFilter filter, float sigma, Executor &executor) {
+  std::vector<float> blur = gaussianKernel1D(sigma);
+  return resampleSeparable(
+      img, ResampleWeights::compute(img.width, width, filter, blur),
+      ResampleWeights::compute(img.height, height, filter, blur), width,
+      height, executor);
+}
+
+Image resizeAndBlur(const Image &img, int width, int height,
+                    ResampleFilter filter, float sigma, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return resizeAndBlur(img, width, height, filter, sigma, executor);
+}
@@ -0,0 +1,134 @@
+#include "include/sparse_kernel.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+SparseKernel SparseKernel::compile(const Kernel &kernel, float tolerance) {
+  SparseKernel result;
+  result.size = kernel.size();
+  const int kHalf = result.size / 2;
+  for (int ky = 0; ky < result.size; ky++) {
+    for (int kx = 0; kx < result.size; kx++) {
+      float value = kernel[ky][kx];
+      float magnitude = std::fabs(value);
+      if (magnitude <= tolerance) {
+        continue;
+      }
+      Tap tap{ky - kHalf, kx - kHalf, value < 0.0f};
+      auto group = std::find_if(
+          result.groups.begin(), result.groups.end(), [&](const Group &g) {
+            return std::fabs(g.coefficient - magnitude) <= tolerance;
+          });
+      if (group == result.groups.end()) {
+        result.groups.push_back(Group{magnitude, {tap}});
+      } else {
+        group->taps.push_back(tap);
+      }
+      result.nonZeroTaps++;
+    }
+  }
+  return result;
+}
+
+void applySparseRow(const SparseKernel &kernel,
+                    const unsigned char *const *rows, int channels, int begin,
+                    int end, float *acc, float *groupSum, unsigned char *out) {
+  const int kHalf = kernel.size / 2;
+  for (int j0 = begin; j0 < end; j0 += SparseKernel::ROW_CHUNK) {
+    const int len = std::min(SparseKernel::ROW_CHUNK, end - j0);
+    float *a = acc;
+    std::fill(a, a + len, 0.0f);
+
+    for (const auto &group : kernel.groups) {
+      float *g = groupSum;
+      std::fill(g, g + len, 0.0f);
+      for (const auto &tap : group.taps) {
+        const unsigned char *p =
+            rows[tap.dy + kHalf] + tap.dx * channels + j0;
+        if (tap.negative) {
+#pragma omp simd
+          for (int j = 0; j < len; j++) {
+            g[j] -= p[j];
+          }
+        } else {
+#pragma omp simd
+          for (int j = 0; j < len; j++) {
+            g[j] += p[j];
+          }
+        }
+      }
+      const float coefficient = group.coefficient;
+#pragma omp simd
+      for (int j = 0; j < len; j++) {
+        a[j] += coefficient * g[j];
+      }
+    }
+
+    unsigned char *o = out + j0;
+#pragma omp simd
+    for (int j = 0; j < len; j++) {
+      o[j] = static_cast<unsigned char>(
+          std::min(std::max(static_cast<int>(a[j]), 0), 255));
+    }
+  }
+  if (channels == 4) {
+    const unsigned char *centre = rows[kHalf];
+    for (int j = begin + 3; j < end; j += 4) {
+      out[j] = centre[j];
+    }
+  }
+}
+
+Image applyKernelSparse(const Image &img, const SparseKernel &kernel,
+                        Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  const int kHalf = kernel.size / 2;
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[width * height * channels];
+  // Only the border rows are copied here: every interior row is first
+  // written by the worker filtering it, which places its pages on that
+  // worker's NUMA node
+  memcpy(output, src, kHalf * rowLen);
+  memcpy(output + (height - kHalf) * rowLen, src + (height - kHalf) * rowLen,
+         kHalf * rowLen);
+
+  // Interior samples of a row, as a contiguous range
+  const int begin = kHalf * channels;
+  const int end = (width - kHalf) * channels;
+
+  struct Scratch {
+    std::vector<float> acc, groupSum;
+    std::vector<const unsigned char *> rows;
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(height - 2 * kHalf, [&](int task, int worker) {
+    Scratch &s = scratch[worker];
+    if (s.rows.empty()) {
+      s.acc.resize(SparseKernel::ROW_CHUNK);
+      s.groupSum.resize(SparseKernel::ROW_CHUNK);
+      s.rows.resize(kernel.size);
+    }
+    const int y = kHalf + task;
+    for (int ky = 0; ky < kernel.size; ky++) {
+      s.rows[ky] = src + (y + ky - kHalf) * rowLen;
+    }
+    unsigned char *out = output + y * rowLen;
+    memcpy(out, s.rows[kHalf], begin);
+    memcpy(out + end, s.rows[kHalf] + end, rowLen - end);
+    applySparseRow(kernel, s.rows.data(), channels, begin, end, s.acc.data(),
+                   s.groupSum.data(), out);
+  });
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelSparse(const Image &img, const SparseKernel &kernel,
+                        int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelSparse(img, kernel, executor);
+}
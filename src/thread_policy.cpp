@@ -0,0 +1,108 @@
+#include "include/thread_policy.h"
+#include "include/numa.h"
+#include "include/sparse_kernel.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <set>
+
+namespace {
+// Work below which another thread costs more than it saves: about 1 ms of
+// the sparse row loop (~0.4 ns per operation on one core)
+constexpr double MIN_OPS_PER_THREAD = 2.5e6;
+// From this many operations per sample a kernel is compute-bound enough for
+// SMT siblings to help; lighter ones saturate the core's load ports
+constexpr double SMT_MIN_OPS = 25;
+
+CpuTopology readSystem() {
+  const NumaTopology &numa = NumaTopology::system();
+  std::vector<std::string> lists;
+  for (int node = 0; node < numa.nodes(); node++) {
+    for (int cpu : numa.cpus(node)) {
+      std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                         "/topology/thread_siblings_list");
+      std::string list;
+      if (!std::getline(file, list) || list.empty()) {
+        list = std::to_string(cpu);
+      }
+      lists.push_back(list);
+    }
+  }
+  return CpuTopology::fromSiblingLists(lists);
+}
+
+std::string count(int n, const std::string &noun) {
+  return std::to_string(n) + " " + noun + (n == 1 ? "" : "s");
+}
+
+std::string millions(double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.1fM", value / 1e6);
+  return text;
+}
+} // namespace
+
+const CpuTopology &CpuTopology::system() {
+  static const CpuTopology topology = readSystem();
+  return topology;
+}
+
+CpuTopology
+CpuTopology::fromSiblingLists(const std::vector<std::string> &lists) {
+  CpuTopology topology;
+  std::set<std::vector<int>> cores;
+  for (const std::string &list : lists) {
+    cores.insert(parseCpuList(list));
+  }
+  topology.logicalCpus = std::max<int>(1, lists.size());
+  topology.physicalCores = std::max<int>(1, cores.size());
+  return topology;
+}
+
+CpuTopology CpuTopology::sharedBy(int processes) const {
+  processes = std::max(1, processes);
+  CpuTopology share;
+  share.physicalCores = std::max(1, physicalCores / processes);
+  share.logicalCpus =
+      std::max(share.physicalCores, logicalCpus / processes);
+  return share;
+}
+
+std::string ThreadDecision::report() const {
+  return "Using " + count(threads, "thread") + (smt ? " (SMT on)" : "") +
+         ": " + reason;
+}
+
+ThreadDecision chooseThreadCount(long samples, double opsPerSample,
+                                 const CpuTopology &topology) {
+  const double ops = static_cast<double>(samples) * opsPerSample;
+  const int byWork = static_cast<int>(
+      std::clamp(ops / MIN_OPS_PER_THREAD, 1.0, 1e6));
+  const bool computeBound = opsPerSample >= SMT_MIN_OPS;
+  const int limit =
+      computeBound ? topology.logicalCpus : topology.physicalCores;
+
+  ThreadDecision decision;
+  decision.threads = std::min(byWork, limit);
+  decision.smt = decision.threads > topology.physicalCores;
+  const std::string work =
+      millions(samples) + " samples x " + std::to_string(
+                                              static_cast<int>(opsPerSample)) +
+      " ops";
+  const std::string cpus = count(topology.physicalCores, "core") + " / " +
+                           count(topology.logicalCpus, "CPU");
+  if (byWork < limit) {
+    decision.reason = work + " is only enough work for " +
+                      std::to_string(byWork) + " of " + cpus;
+  } else if (!computeBound && topology.logicalCpus > topology.physicalCores) {
+    decision.reason =
+        work + ", memory-bound kernel: one thread per core of " + cpus;
+  } else {
+    decision.reason = work + ", all of " + cpus;
+  }
+  return decision;
+}
+
+double kernelOpsPerSample(const Kernel &kernel) {
+  return std::max(1, SparseKernel::compile(kernel).nonZeroTaps);
+}
@@ -0,0 +1,161 @@
+#include "include/thread_pool.h"
+#include "include/numa.h"
+#include <algorithm>
+#include <immintrin.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+// Pause iterations a helper spins for the next job before sleeping, tens to
+// a couple of hundred microseconds depending on the pause latency
+constexpr int SPIN_ITERATIONS = 1 << 12;
+
+// Set while the current thread runs a task of any pool, so nested
+// parallelFor() calls run inline instead of waiting on busy workers
+thread_local bool inTask = false;
+
+void pinCurrentThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+} // namespace
+
+ThreadPool::ThreadPool(int nthreads, bool pin, PoolSchedule schedule)
+    : nthreads(std::max(1, nthreads)), schedule(schedule) {
+  const NumaTopology &topology = NumaTopology::system();
+  // Spinning threads would steal the CPU from the ones doing the work
+  spinIterations =
+      this->nthreads <= topology.totalCpus() ? SPIN_ITERATIONS : 0;
+  // Workers fill one node after the other, so banded rows stay node-local
+  std::vector<int> cpus;
+  if (pin) {
+    cpus = topology.workerCpus(this->nthreads);
+  }
+  threads.reserve(this->nthreads - 1);
+  for (int worker = 1; worker < this->nthreads; worker++) {
+    const int cpu = cpus.empty() ? -1 : cpus[worker];
+    threads.emplace_back(&ThreadPool::workerLoop, this, worker, cpu);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::run(int task, int worker) {
+  try {
+    (*job)(task, worker);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+    next.store(jobCount);
+  }
+}
+
+void ThreadPool::drain(int worker) {
+  inTask = true;
+  if (schedule == PoolSchedule::RowBands) {
+    const int first = static_cast<long>(jobCount) * worker / nthreads;
+    const int last = static_cast<long>(jobCount) * (worker + 1) / nthreads;
+    // next only reaches jobCount here when a task failed
+    for (int i = first;
+         i < last && next.load(std::memory_order_relaxed) < jobCount; i++) {
+      run(i, worker);
+    }
+  } else {
+    for (int i = next.fetch_add(1); i < jobCount; i = next.fetch_add(1)) {
+      run(i, worker);
+    }
+  }
+  inTask = false;
+}
+
+void ThreadPool::workerLoop(int worker, int cpu) {
+  if (cpu >= 0) {
+    pinCurrentThread(cpu);
+  }
+  uint64_t seen = 0;
+  for (;;) {
+    for (int spin = 0;
+         spin < spinIterations && generation.load() == seen; spin++) {
+      _mm_pause();
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation.load() != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation.load();
+    }
+    drain(worker);
+    if (pending.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.notify_one();
+    }
+  }
+}
+
+void ThreadPool::parallelFor(int count, const Task &task) {
+  if (count <= 0) {
+    return;
+  }
+  if (inTask || nthreads == 1 || count == 1) {
+    // Calls nested in these tasks must run inline as well
+    const bool outer = inTask;
+    inTask = true;
+    try {
+      for (int i = 0; i < count; i++) {
+        task(i, 0);
+      }
+    } catch (...) {
+      inTask = outer;
+      throw;
+    }
+    inTask = outer;
+    return;
+  }
+
+  std::lock_guard<std::mutex> submit(submitMutex);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &task;
+    jobCount = count;
+    next.store(0);
+    pending.store(nthreads - 1);
+    error = nullptr;
+    generation.fetch_add(1);
+  }
+  wake.notify_all();
+
+  drain(0);
+
+  for (int spin = 0; spin < spinIterations && pending.load() > 0; spin++) {
+    _mm_pause();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return pending.load() == 0; });
+  job = nullptr;
+  if (error) {
+    std::exception_ptr thrown = error;
+    error = nullptr;
+    std::rethrow_exception(thrown);
+  }
+}
@@ -0,0 +1,175 @@
+#include "include/transpose.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace {
+// Blocks up to this many pixels per side are transposed directly
+constexpr int BASE = 16;
+
+void transposeBase(const unsigned char *src, int srcStride, unsigned char *dst,
+                   int dstStride, int width, int height, int channels) {
+  int y = 0;
+  if (channels == 4) {
+    // 4x4 tiles of 32 bit pixels with two rounds of unpacks
+    for (; y + 4 <= height; y += 4) {
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        const unsigned char *s = src + y * srcStride + x * 4;
+        __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+        __m128i r1 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(s + srcStride));
+        __m128i r2 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(s + 2 * srcStride));
+        __m128i r3 = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(s + 3 * srcStride));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        unsigned char *d = dst + x * dstStride + y * 4;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d),
+                         _mm_unpacklo_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + dstStride),
+                         _mm_unpackhi_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + 2 * dstStride),
+                         _mm_unpacklo_epi64(t1, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + 3 * dstStride),
+                         _mm_unpackhi_epi64(t1, t3));
+      }
+      for (int yy = y; yy < y + 4; yy++) {
+        for (int xx = x; xx < width; xx++) {
+          memcpy(dst + xx * dstStride + yy * 4, src + yy * srcStride + xx * 4,
+                 4);
+        }
+      }
+    }
+  }
+  if (channels == 3) {
+    for (; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        memcpy(dst + x * dstStride + y * 3, src + y * srcStride + x * 3, 3);
+      }
+    }
+  }
+  for (; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      memcpy(dst + x * dstStride + y * channels,
+             src + y * srcStride + x * channels, channels);
+    }
+  }
+}
+
+void transposeBase(const float *src, int srcStride, float *dst, int dstStride,
+                   int width, int height, int channels) {
+  if (channels == 4) {
+    // A 4-channel float pixel is exactly one SSE register
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        _mm_storeu_ps(dst + x * dstStride + y * 4,
+                      _mm_loadu_ps(src + y * srcStride + x * 4));
+      }
+    }
+    return;
+  }
+  int y = 0;
+  if (channels == 1) {
+    for (; y + 4 <= height; y += 4) {
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        const float *s = src + y * srcStride + x;
+        __m128 r0 = _mm_loadu_ps(s);
+        __m128 r1 = _mm_loadu_ps(s + srcStride);
+        __m128 r2 = _mm_loadu_ps(s + 2 * srcStride);
+        __m128 r3 = _mm_loadu_ps(s + 3 * srcStride);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        float *d = dst + x * dstStride + y;
+        _mm_storeu_ps(d, r0);
+        _mm_storeu_ps(d + dstStride, r1);
+        _mm_storeu_ps(d + 2 * dstStride, r2);
+        _mm_storeu_ps(d + 3 * dstStride, r3);
+      }
+      for (int yy = y; yy < y + 4; yy++) {
+        for (int xx = x; xx < width; xx++) {
+          dst[xx * dstStride + yy] = src[yy * srcStride + xx];
+        }
+      }
+    }
+  }
+  if (channels == 3) {
+    for (; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const float *s = src + y * srcStride + x * 3;
+        float *d = dst + x * dstStride + y * 3;
+        d[0] = s[0];
+        d[1] = s[1];
+        d[2] = s[2];
+      }
+    }
+  }
+  for (; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        dst[x * dstStride + y * channels + c] =
+            src[y * srcStride + x * channels + c];
+      }
+    }
+  }
+}
+
+template <typename T>
+void transposeRecursive(const T *src, int srcStride, T *dst, int dstStride,
+                        int width, int height, int channels) {
+  if (width <= BASE && height <= BASE) {
+    transposeBase(src, srcStride, dst, dstStride, width, height, channels);
+  } else if (width >= height) {
+    int half = width / 2;
+    transposeRecursive(src, srcStride, dst, dstStride, half, height,
+                       channels);
+    transposeRecursive(src + half * channels, srcStride,
+                       dst + half * dstStride, dstStride, width - half, height,
+                       channels);
+  } else {
+    int half = height / 2;
+    transposeRecursive(src, srcStride, dst, dstStride, width, half, channels);
+    transposeRecursive(src + half * srcStride, srcStride, dst + half * channels,
+                       dstStride, width, height - half, channels);
+  }
+}
+} // namespace
+
+void transposePixels(const unsigned char *src, int srcStride,
+                     unsigned char *dst, int dstStride, int width, int height,
+                     int channels) {
+  transposeRecursive(src, srcStride, dst, dstStride, width, height, channels);
+}
+
+void transposePixels(const float *src, int srcStride, float *dst,
+                     int dstStride, int width, int height, int channels) {
+  transposeRecursive(src, srcStride, dst, dstStride, width, height, channels);
+}
+
+Image transposeImage(const Image &img, Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  unsigned char *output = new unsigned char[width * height * channels];
+  // Independent horizontal stripes of the source, each transposed
+  // recursively into a vertical stripe of the destination
+  const int stripe = 64;
+  const int stripes = (height + stripe - 1) / stripe;
+  executor.parallelFor(stripes, [&](int s, int) {
+    const int y0 = s * stripe;
+    const int rows = std::min(stripe, height - y0);
+    transposePixels(img.data.get() + y0 * width * channels, width * channels,
+                    output + y0 * channels, height * channels, width, rows,
+                    channels);
+  });
+  return Image(output, height, width, channels);
+}
+
+Image transposeImage(const Image &img, int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return transposeImage(img, executor);
+}
@@ -0,0 +1,116 @@
+#include "include/unsharp_mask.h"
+#include "include/gaussian.h"
+#include "include/image_processing.h"
+#include "include/processing_context.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+constexpr int TILE_ROWS = 64;
+constexpr int TILE_COLS = 256;
+} // namespace
+
+Image unsharpMask(const Image &img, const UnsharpMaskParams &params,
+                  Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const std::vector<float> taps = gaussianKernel1D(params.sigma);
+  const int radius = taps.size() / 2;
+  const int ntaps = taps.size();
+  const float amount = params.amount;
+  const float threshold = static_cast<float>(params.threshold);
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[width * height * channels];
+
+  const int tilesY = (height + TILE_ROWS - 1) / TILE_ROWS;
+  const int tilesX = (width + TILE_COLS - 1) / TILE_COLS;
+
+  // Per-worker scratch: one clamped source row segment, the horizontally
+  // blurred rows of the tile plus its vertical halo, and one blurred row.
+  struct Scratch {
+    std::vector<float> segment, horizontal, blurred;
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(tilesY * tilesX, [&](int task, int worker) {
+    Scratch &local = scratch[worker];
+    if (local.segment.empty()) {
+      local.segment.resize((TILE_COLS + 2 * radius) * channels);
+      local.horizontal.resize((TILE_ROWS + 2 * radius) * TILE_COLS * channels);
+      local.blurred.resize(TILE_COLS * channels);
+    }
+    std::vector<float> &segment = local.segment;
+    std::vector<float> &horizontal = local.horizontal;
+    std::vector<float> &blurred = local.blurred;
+    const int y0 = task / tilesX * TILE_ROWS;
+    const int x0 = task % tilesX * TILE_COLS;
+    const int tileH = std::min(TILE_ROWS, height - y0);
+    const int tileW = std::min(TILE_COLS, width - x0);
+    const int rowLen = tileW * channels;
+
+    // Horizontal pass over the tile rows and the vertical halo
+    for (int i = 0; i < tileH + 2 * radius; i++) {
+      int sy = clamp(y0 - radius + i, 0, height - 1);
+      const unsigned char *srcRow = src + sy * width * channels;
+      for (int x = 0; x < tileW + 2 * radius; x++) {
+        int sx = clamp(x0 - radius + x, 0, width - 1);
+        for (int c = 0; c < channels; c++) {
+          segment[x * channels + c] = srcRow[sx * channels + c];
+        }
+      }
+
+      float *hRow = horizontal.data() + i * rowLen;
+      std::fill(hRow, hRow + rowLen, 0.0f);
+      for (int k = 0; k < ntaps; k++) {
+        const float w = taps[k];
+        const float *s = segment.data() + k * channels;
+#pragma omp simd
+        for (int j = 0; j < rowLen; j++) {
+          hRow[j] += w * s[j];
+        }
+      }
+    }
+
+    // Vertical pass fused with the sharpening combination
+    for (int y = 0; y < tileH; y++) {
+      std::fill(blurred.begin(), blurred.begin() + rowLen, 0.0f);
+      float *b = blurred.data();
+      for (int k = 0; k < ntaps; k++) {
+        const float w = taps[k];
+        const float *hRow = horizontal.data() + (y + k) * rowLen;
+#pragma omp simd
+        for (int j = 0; j < rowLen; j++) {
+          b[j] += w * hRow[j];
+        }
+      }
+
+      const size_t offset = ((y0 + y) * width + x0) * channels;
+      const unsigned char *in = src + offset;
+      unsigned char *out = output + offset;
+#pragma omp simd
+      for (int j = 0; j < rowLen; j++) {
+        float original = in[j];
+        float diff = original - b[j];
+        float value =
+            std::fabs(diff) >= threshold ? original + amount * diff
+                                         : original;
+        value = std::min(std::max(value, 0.0f), 255.0f);
+        out[j] = static_cast<unsigned char>(value + 0.5f);
+      }
+      if (channels == 4) {
+        for (int x = 0; x < tileW; x++) {
+          out[x * 4 + 3] = in[x * 4 + 3];
+        }
+      }
+    }
+  });
+  return Image(output, width, height, channels);
+}
+
+Image unsharpMask(const Image &img, const UnsharpMaskParams &params,
+                  int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return unsharpMask(img, params, executor);
+}
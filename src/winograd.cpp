@@ -0,0 +1,187 @@
+#include "include/winograd.h"
+#include "include/processing_context.h"
+#include <cstring>
+#include <vector>
+
+namespace {
+inline unsigned char truncateToByte(float value) {
+  return static_cast<unsigned char>(clamp(static_cast<int>(value), 0, 255));
+}
+
+// Direct evaluation of one output pixel, used for the rows and columns that
+// do not fill a whole 2x2 tile
+void convolvePixel(const Image &img, const Kernel &kernel, int y, int x,
+                   unsigned char *output) {
+  const int channels = img.channels;
+  const unsigned char *src = img.data.get();
+  unsigned char *out = output + (y * img.width + x) * channels;
+  for (int c = 0; c < channels; c++) {
+    float sum = 0.0f;
+    for (int ky = 0; ky < 3; ky++) {
+      for (int kx = 0; kx < 3; kx++) {
+        sum += src[((y + ky - 1) * img.width + x + kx - 1) * channels + c] *
+               kernel[ky][kx];
+      }
+    }
+    out[c] = truncateToByte(sum);
+  }
+  if (channels == 4) {
+    out[3] = src[(y * img.width + x) * channels + 3];
+  }
+}
+} // namespace
+
+Image applyKernelWinograd3x3(const Image &img, const Kernel &kernel,
+                             Executor &executor) {
+  const int width = img.width;
+  const int height = img.height;
+  const int channels = img.channels;
+  const int rowLen = width * channels;
+  const unsigned char *src = img.data.get();
+
+  unsigned char *output = new unsigned char[width * height * channels];
+
+  // Filter transform U = G g G^T
+  float gG[4][3];
+  for (int j = 0; j < 3; j++) {
+    gG[0][j] = kernel[0][j];
+    gG[1][j] = 0.5f * (kernel[0][j] + kernel[1][j] + kernel[2][j]);
+    gG[2][j] = 0.5f * (kernel[0][j] - kernel[1][j] + kernel[2][j]);
+    gG[3][j] = kernel[2][j];
+  }
+  float U[4][4];
+  for (int i = 0; i < 4; i++) {
+    U[i][0] = gG[i][0];
+    U[i][1] = 0.5f * (gG[i][0] + gG[i][1] + gG[i][2]);
+    U[i][2] = 0.5f * (gG[i][0] - gG[i][1] + gG[i][2]);
+    U[i][3] = gG[i][2];
+  }
+
+  // Only whole tiles go through the transforms
+  const int tilesX = (width - 2) / 2;
+  const int tilesY = (height - 2) / 2;
+  const int lanes = tilesX * channels;
+
+  // Rows outside the tiles here: the top border, the leftover row of an odd
+  // interior and the bottom border. Tile rows get their border pixels from
+  // the worker transforming them (see applyKernelSparse).
+  const int tiledEnd = 1 + 2 * tilesY;
+  memcpy(output, src, rowLen);
+  memcpy(output + tiledEnd * rowLen, src + tiledEnd * rowLen,
+         (height - tiledEnd) * rowLen);
+
+  struct Scratch {
+    // Even and odd pixels of the 4 input rows of a tile row, deinterleaved
+    // so that tile column j of lane e is a plain array access
+    std::vector<float> evenBuf[4], oddBuf[4];
+    std::vector<float> result[4];
+  };
+  std::vector<Scratch> scratch(executor.workers());
+  executor.parallelFor(tilesY, [&](int ty, int worker) {
+    Scratch &s = scratch[worker];
+    if (s.result[0].empty()) {
+      for (int r = 0; r < 4; r++) {
+        s.evenBuf[r].resize((tilesX + 1) * channels);
+        s.oddBuf[r].resize((tilesX + 1) * channels);
+        s.result[r].resize(lanes);
+      }
+    }
+    std::vector<float> *evenBuf = s.evenBuf, *oddBuf = s.oddBuf;
+    std::vector<float> *result = s.result;
+    const int y = 1 + 2 * ty;
+    for (int r = 1; r <= 2; r++) {
+      const int row = (y - 1 + r) * rowLen;
+      memcpy(output + row, src + row, channels);
+      memcpy(output + row + rowLen - channels, src + row + rowLen - channels,
+             channels);
+    }
+    for (int r = 0; r < 4; r++) {
+      const unsigned char *row = src + (y - 1 + r) * rowLen;
+      for (int tx = 0; tx <= tilesX; tx++) {
+        for (int c = 0; c < channels; c++) {
+          evenBuf[r][tx * channels + c] = row[2 * tx * channels + c];
+          oddBuf[r][tx * channels + c] = row[(2 * tx + 1) * channels + c];
+        }
+      }
+    }
+
+    const float *e0 = evenBuf[0].data(), *o0 = oddBuf[0].data();
+    const float *e1 = evenBuf[1].data(), *o1 = oddBuf[1].data();
+    const float *e2 = evenBuf[2].data(), *o2 = oddBuf[2].data();
+    const float *e3 = evenBuf[3].data(), *o3 = oddBuf[3].data();
+    float *y00 = result[0].data(), *y01 = result[1].data();
+    float *y10 = result[2].data(), *y11 = result[3].data();
+    const int C = channels;
+
+#pragma omp simd
+    for (int e = 0; e < lanes; e++) {
+      // Input tile d (4x4): columns are even, odd, next even, next odd
+      // Row transform t = d B
+      float t00 = e0[e] - e0[e + C], t01 = o0[e] + e0[e + C];
+      float t02 = e0[e + C] - o0[e], t03 = o0[e] - o0[e + C];
+      float t10 = e1[e] - e1[e + C], t11 = o1[e] + e1[e + C];
+      float t12 = e1[e + C] - o1[e], t13 = o1[e] - o1[e + C];
+      float t20 = e2[e] - e2[e + C], t21 = o2[e] + e2[e + C];
+      float t22 = e2[e + C] - o2[e], t23 = o2[e] - o2[e + C];
+      float t30 = e3[e] - e3[e + C], t31 = o3[e] + e3[e + C];
+      float t32 = e3[e + C] - o3[e], t33 = o3[e] - o3[e + C];
+
+      // Column transform V = B^T t, multiplied elementwise by U
+      float m00 = U[0][0] * (t00 - t20), m01 = U[0][1] * (t01 - t21);
+      float m02 = U[0][2] * (t02 - t22), m03 = U[0][3] * (t03 - t23);
+      float m10 = U[1][0] * (t10 + t20), m11 = U[1][1] * (t11 + t21);
+      float m12 = U[1][2] * (t12 + t22), m13 = U[1][3] * (t13 + t23);
+      float m20 = U[2][0] * (t20 - t10), m21 = U[2][1] * (t21 - t11);
+      float m22 = U[2][2] * (t22 - t12), m23 = U[2][3] * (t23 - t13);
+      float m30 = U[3][0] * (t10 - t30), m31 = U[3][1] * (t11 - t31);
+      float m32 = U[3][2] * (t12 - t32), m33 = U[3][3] * (t13 - t33);
+
+      // Output transform Y = A^T M A
+      float s00 = m00 + m01 + m02, s01 = m01 - m02 - m03;
+      float s10 = m10 + m11 + m12, s11 = m11 - m12 - m13;
+      float s20 = m20 + m21 + m22, s21 = m21 - m22 - m23;
+      float s30 = m30 + m31 + m32, s31 = m31 - m32 - m33;
+      y00[e] = s00 + s10 + s20;
+      y01[e] = s01 + s11 + s21;
+      y10[e] = s10 - s20 - s30;
+      y11[e] = s11 - s21 - s31;
+    }
+
+    unsigned char *top = output + y * rowLen + channels;
+    unsigned char *bottom = top + rowLen;
+    for (int tx = 0; tx < tilesX; tx++) {
+      for (int c = 0; c < channels; c++) {
+        int e = tx * channels + c;
+        top[2 * tx * channels + c] = truncateToByte(y00[e]);
+        top[(2 * tx + 1) * channels + c] = truncateToByte(y01[e]);
+        bottom[2 * tx * channels + c] = truncateToByte(y10[e]);
+        bottom[(2 * tx + 1) * channels + c] = truncateToByte(y11[e]);
+      }
+    }
+    if (channels == 4) {
+      for (int x = 1; x <= 2 * tilesX; x++) {
+        top[(x - 1) * 4 + 3] = src[y * rowLen + x * 4 + 3];
+        bottom[(x - 1) * 4 + 3] = src[(y + 1) * rowLen + x * 4 + 3];
+      }
+    }
+  });
+
+  // Leftover column and row when the interior has an odd size
+  if ((width - 2) % 2 != 0) {
+    for (int y = 1; y < 1 + 2 * tilesY; y++) {
+      convolvePixel(img, kernel, y, width - 2, output);
+    }
+  }
+  if ((height - 2) % 2 != 0) {
+    for (int x = 1; x < width - 1; x++) {
+      convolvePixel(img, kernel, height - 2, x, output);
+    }
+  }
+  return Image(output, width, height, channels);
+}
+
+Image applyKernelWinograd3x3(const Image &img, const Kernel &kernel,
+                             int nthreads) {
+  Executor &executor = ProcessingContext::shared(nthreads).executor();
+  return applyKernelWinograd3x3(img, kernel, executor);
+}
@@ -0,0 +1,205 @@
+#include "include/work_stealing.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+uint64_t pack(TaskRange range) {
+  return static_cast<uint64_t>(static_cast<uint32_t>(range.begin)) << 32 |
+         static_cast<uint32_t>(range.end);
+}
+
+TaskRange unpack(uint64_t packed) {
+  TaskRange range;
+  range.begin = static_cast<int>(packed >> 32);
+  range.end = static_cast<int>(packed & 0xffffffffu);
+  return range;
+}
+
+// Steal attempts over random victims before yielding the CPU
+constexpr int STEAL_ROUNDS = 4;
+
+// Set while the current thread runs a slot, so nested parallelFor() calls
+// run inline instead of resetting the deques in use
+thread_local bool inSlot = false;
+} // namespace
+
+bool ChaseLevDeque::push(TaskRange range) {
+  const int64_t b = bottom.load(std::memory_order_relaxed);
+  const int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= CAPACITY) {
+    return false;
+  }
+  slots[b % CAPACITY].store(pack(range), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+bool ChaseLevDeque::take(TaskRange &range) {
+  const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+  if (t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+  range = unpack(slots[b % CAPACITY].load(std::memory_order_relaxed));
+  if (t == b) {
+    // Last entry: race the thieves for it
+    const bool won = top.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+bool ChaseLevDeque::steal(TaskRange &range) {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  const int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b) {
+    return false;
+  }
+  range = unpack(slots[t % CAPACITY].load(std::memory_order_relaxed));
+  return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed);
+}
+
+WorkStealingExecutor::WorkStealingExecutor(int nthreads)
+    : pool(nthreads), slots(pool.workers()) {}
+
+void WorkStealingExecutor::runSlot(int slot, int worker, const Task &task) {
+  using Clock = std::chrono::steady_clock;
+  const int nslots = slots.size();
+  ChaseLevDeque &deque = slots[slot].deque;
+  WorkerStats &stats = slots[slot].stats;
+  uint32_t seed = 2654435761u * (slot + 1);
+  // Start with single tasks until a first cost measurement exists
+  int grain = 1;
+
+  inSlot = true;
+  TaskRange range;
+  while (!aborted.load(std::memory_order_relaxed)) {
+    if (!deque.take(range)) {
+      bool stolen = false;
+      for (int round = 0; !stolen && remaining.load() > 0 &&
+                          !aborted.load(std::memory_order_relaxed);
+           round++) {
+        for (int attempt = 0; attempt < nslots - 1; attempt++) {
+          seed ^= seed << 13;
+          seed ^= seed >> 17;
+          seed ^= seed << 5;
+          int victim = seed % (nslots - 1);
+          victim += victim >= slot;
+          if (slots[victim].deque.steal(range)) {
+            stats.steals++;
+            stolen = true;
+            break;
+          }
+          stats.failedSteals++;
+        }
+        if (!stolen && round % STEAL_ROUNDS == STEAL_ROUNDS - 1) {
+          std::this_thread::yield();
+        }
+      }
+      if (!stolen) {
+        break;
+      }
+    }
+
+    // Keep the lower part, offer the upper halves to thieves
+    while (range.size() > grain) {
+      const int mid = range.begin + range.size() / 2;
+      if (!deque.push({mid, range.end})) {
+        break;
+      }
+      range.end = mid;
+    }
+
+    const Clock::time_point start = Clock::now();
+    try {
+      for (int i = range.begin; i < range.end; i++) {
+        task(i, worker);
+      }
+    } catch (...) {
+      aborted = true;
+      inSlot = false;
+      throw;
+    }
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    const double perTask = seconds / range.size();
+    grain = perTask > 0 ? static_cast<int>(std::clamp(
+                              TARGET_CHUNK_SECONDS / perTask, 1.0,
+                              static_cast<double>(maxGrain)))
+                        : maxGrain;
+
+    stats.tasks += range.size();
+    stats.chunks++;
+    stats.busySeconds += seconds;
+    remaining.fetch_sub(range.size());
+  }
+  inSlot = false;
+}
+
+void WorkStealingExecutor::parallelFor(int count, const Task &task) {
+  if (count <= 0) {
+    return;
+  }
+  if (inSlot) {
+    for (int i = 0; i < count; i++) {
+      task(i, 0);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> submit(submitMutex);
+  const int nslots = slots.size();
+  // Drop whatever an aborted call left behind. A throwing task propagates
+  // out of pool.parallelFor(), so this cannot wait until after it.
+  TaskRange leftover;
+  for (Slot &slot : slots) {
+    while (slot.deque.take(leftover)) {
+    }
+  }
+  // Leave at least a few chunks per worker to steal
+  maxGrain = std::max(1, count / (4 * nslots));
+  remaining = count;
+  aborted = false;
+  for (int s = 0; s < nslots; s++) {
+    TaskRange share{static_cast<int>(static_cast<long>(count) * s / nslots),
+                    static_cast<int>(static_cast<long>(count) * (s + 1) /
+                                     nslots)};
+    if (share.size() > 0) {
+      slots[s].deque.push(share);
+    }
+  }
+  pool.parallelFor(nslots, [&](int slot, int worker) {
+    runSlot(slot, worker, task);
+  });
+}
+
+std::vector<WorkerStats> WorkStealingExecutor::stats() const {
+  std::vector<WorkerStats> result;
+  for (const Slot &slot : slots) {
+    result.push_back(slot.stats);
+  }
+  return result;
+}
+
+void WorkStealingExecutor::resetStats() {
+  for (Slot &slot : slots) {
+    slot.stats = WorkerStats();
+  }
+}
+
+double WorkStealingExecutor::loadImbalance() const {
+  double total = 0, busiest = 0;
+  for (const Slot &slot : slots) {
+    total += slot.stats.busySeconds;
+    busiest = std::max(busiest, slot.stats.busySeconds);
+  }
+  return total > 0 ? busiest * slots.size() / total : 1.0;
+}
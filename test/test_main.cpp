@@ -1,4 +1,32 @@
 #include "../src/include/image_processing.h"
+#include "../src/include/unsharp_mask.h"
+#include "../src/include/pyramid.h"
+#include "../src/include/resample.h"
+#include "../src/include/box_filter.h"
+#include "../src/include/guided_filter.h"
+#include "../src/include/non_local_means.h"
+#include "../src/include/convolution.h"
+#include "../src/include/sparse_kernel.h"
+#include "../src/include/kernel_decomposition.h"
+#include "../src/include/jit_kernel.h"
+#include "../src/include/lut_kernel.h"
+#include "../src/include/transpose.h"
+#include "../src/include/iterated_kernel.h"
+#include "../src/include/flat_tiles.h"
+#include "../src/include/executor.h"
+#include "../src/include/processing_context.h"
+#include "../src/include/work_stealing.h"
+#include "../src/include/numa.h"
+#include "../src/include/thread_policy.h"
+#include "../src/include/batch_processor.h"
+#include "../src/include/pipeline.h"
+#include "../src/include/async_filter.h"
+#include "../src/include/distributed.h"
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <set>
 #include <gtest/gtest.h>
 
 // 10 10 10 10 10
@@ -30,6 +58,1343 @@ TEST(LowPassFilterTest, LowPass3x3) {
   }
 }
 
+// Vertical step edge 40 | 200: the unsharp mask must overshoot on both sides
+// of the edge and leave flat areas and sub-threshold detail untouched.
+TEST(UnsharpMaskTest, SharpensEdgesOnly) {
+  int width = 16, height = 8, channels = 1;
+  unsigned char *testImage = new unsigned char[width * height * channels];
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      testImage[y * width + x] = x < width / 2 ? 40 : 200;
+    }
+  }
+  Image testImg = Image(testImage, width, height, channels);
+
+  UnsharpMaskParams params;
+  params.sigma = 1.0f;
+  params.amount = 1.0f;
+  Image sharpened = unsharpMask(testImg, params, 2);
+  for (int y = 0; y < height; y++) {
+    const unsigned char *row = sharpened.data.get() + y * width;
+    EXPECT_EQ(row[0], 40);
+    EXPECT_EQ(row[width - 1], 200);
+    EXPECT_LT(row[width / 2 - 1], 40);
+    EXPECT_GT(row[width / 2], 200);
+  }
+
+  params.threshold = 255;
+  Image untouched = unsharpMask(testImg, params, 2);
+  EXPECT_EQ(memcmp(untouched.data.get(), testImg.data.get(), width * height),
+            0);
+}
+
+TEST(PyramidTest, LevelsAreCachedAndReconstructExactly) {
+  int width = 37, height = 20, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 37) % 251;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+
+  ImagePyramid pyramid(testImg, 4, 2);
+  ASSERT_EQ(pyramid.levels(), 4);
+  EXPECT_EQ(pyramid.gaussian(1).width, 19);
+  EXPECT_EQ(pyramid.gaussian(1).height, 10);
+  EXPECT_EQ(pyramid.gaussian(3).width, 5);
+  EXPECT_EQ(pyramid.gaussian(3).height, 3);
+  EXPECT_EQ(&pyramid.laplacian(2), &pyramid.laplacian(2));
+
+  pyramid.buildAll();
+  Image restored = pyramid.reconstruct();
+  EXPECT_EQ(memcmp(restored.data.get(), testImg.data.get(), sz), 0);
+}
+
+TEST(ResampleTest, PreservesFlatImagesAndAveragesBlocks) {
+  int width = 8, height = 6, channels = 2;
+  int sz = width * height * channels;
+  unsigned char *flat = new unsigned char[sz];
+  memset(flat, 77, sz);
+  Image flatImg = Image(flat, width, height, channels);
+  for (auto filter : {ResampleFilter::Box, ResampleFilter::Bilinear,
+                      ResampleFilter::Bicubic, ResampleFilter::Lanczos3}) {
+    for (auto size : {std::make_pair(3, 2), std::make_pair(13, 11)}) {
+      Image resized = resize(flatImg, size.first, size.second, filter, 2);
+      ASSERT_EQ(resized.width, size.first);
+      ASSERT_EQ(resized.height, size.second);
+      for (int i = 0; i < size.first * size.second * channels; i++) {
+        EXPECT_EQ(resized.data.get()[i], 77);
+      }
+    }
+    Image blurred = resizeAndBlur(flatImg, 5, 4, filter, 1.0f, 2);
+    for (int i = 0; i < 5 * 4 * channels; i++) {
+      EXPECT_EQ(blurred.data.get()[i], 77);
+    }
+  }
+
+  // 2x box downscale of a 4x2 single channel image averages 2x2 blocks
+  unsigned char *blocks = new unsigned char[8]{10, 20, 100, 100,
+                                               30, 40, 0, 200};
+  Image blocksImg = Image(blocks, 4, 2, 1);
+  Image half = resize(blocksImg, 2, 1, ResampleFilter::Box, 1);
+  EXPECT_EQ(half.data.get()[0], 25);
+  EXPECT_EQ(half.data.get()[1], 100);
+}
+
+TEST(GuidedFilterTest, BoxMeanMatchesNaiveWindows) {
+  FloatImage img(9, 7, 2);
+  for (size_t i = 0; i < img.data.size(); i++) {
+    img.data[i] = static_cast<float>((i * 13) % 29);
+  }
+  int radius = 2;
+  FloatImage mean = boxMean(img, radius, 2);
+  for (int y = 0; y < img.height; y++) {
+    for (int x = 0; x < img.width; x++) {
+      for (int c = 0; c < img.channels; c++) {
+        float sum = 0.0f;
+        int count = 0;
+        for (int yy = std::max(0, y - radius);
+             yy <= std::min(img.height - 1, y + radius); yy++) {
+          for (int xx = std::max(0, x - radius);
+               xx <= std::min(img.width - 1, x + radius); xx++) {
+            sum += img.row(yy)[xx * img.channels + c];
+            count++;
+          }
+        }
+        EXPECT_NEAR(mean.row(y)[x * img.channels + c], sum / count, 1e-4);
+      }
+    }
+  }
+}
+
+TEST(GuidedFilterTest, PreservesEdgesAndSmoothsNoise) {
+  int width = 20, height = 10, channels = 1;
+  unsigned char *testImage = new unsigned char[width * height];
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // Step edge with +-2 checkerboard noise on both sides
+      int base = x < width / 2 ? 50 : 200;
+      testImage[y * width + x] = base + ((x + y) % 2 ? 2 : -2);
+    }
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  Image filtered = guidedFilter(testImg, testImg, 3, 0.01f, 2);
+  for (int y = 0; y < height; y++) {
+    const unsigned char *row = filtered.data.get() + y * width;
+    // A box mean of the same radius would pull these to about 114 and 136
+    EXPECT_NEAR(row[2], 50, 1);
+    EXPECT_LT(row[width / 2 - 1], 65);
+    EXPECT_GT(row[width / 2], 185);
+    EXPECT_NEAR(row[width - 3], 200, 1);
+  }
+}
+
+TEST(GuidedFilterTest, RowStripsMatchFullFrameBoxMeans) {
+  int width = 23, height = 150, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *inputData = new unsigned char[sz];
+  unsigned char *guideData = new unsigned char[width * height];
+  for (int i = 0; i < sz; i++) {
+    inputData[i] = (i * 97 + i / 11) % 256;
+  }
+  for (int i = 0; i < width * height; i++) {
+    guideData[i] = (i % width < width / 2 ? 40 : 180) + (i * 31) % 50;
+  }
+  Image input = Image(inputData, width, height, channels);
+  Image guide = Image(guideData, width, height, 1);
+  float epsilon = 0.02f;
+  for (int radius : {2, 20}) {
+    // The same filter written with full-frame boxMean images
+    FloatImage stats(width, height, 4 * channels);
+    for (int i = 0; i < sz; i++) {
+      float vi = guideData[i / channels] / 255.0f;
+      float vp = inputData[i] / 255.0f;
+      stats.data[4 * i] = vi;
+      stats.data[4 * i + 1] = vp;
+      stats.data[4 * i + 2] = vi * vp;
+      stats.data[4 * i + 3] = vi * vi;
+    }
+    FloatImage means = boxMean(stats, radius, 1);
+    FloatImage coeffs(width, height, 2 * channels);
+    for (int i = 0; i < sz; i++) {
+      const float *m = means.data.data() + 4 * i;
+      float a = (m[2] - m[0] * m[1]) / (m[3] - m[0] * m[0] + epsilon);
+      coeffs.data[2 * i] = a;
+      coeffs.data[2 * i + 1] = m[1] - a * m[0];
+    }
+    FloatImage meanCoeffs = boxMean(coeffs, radius, 1);
+
+    Image filtered = guidedFilter(guide, input, radius, epsilon, 2);
+    for (int i = 0; i < sz; i++) {
+      float q = (meanCoeffs.data[2 * i] * stats.data[4 * i] +
+                 meanCoeffs.data[2 * i + 1]) *
+                255.0f;
+      float expected = std::min(std::max(q, 0.0f), 255.0f);
+      EXPECT_NEAR(filtered.data.get()[i], expected, 1)
+          << "radius " << radius << " index " << i;
+    }
+  }
+}
+
+TEST(NonLocalMeansTest, ReducesNoiseAndKeepsEdges) {
+  int width = 70, height = 40, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *noisy = new unsigned char[sz];
+  unsigned int seed = 12345;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        seed = seed * 1103515245 + 12345;
+        int noise = static_cast<int>((seed >> 16) % 21) - 10;
+        int base = x < width / 2 ? 60 : 190;
+        noisy[(y * width + x) * channels + c] = base + noise;
+      }
+    }
+  }
+  Image noisyImg = Image(noisy, width, height, channels);
+
+  NonLocalMeansParams params;
+  params.searchRadius = 5;
+  params.patchRadius = 1;
+  params.h = 12.0f;
+  Image denoised = nonLocalMeans(noisyImg, params, 2);
+
+  double errorBefore = 0.0, errorAfter = 0.0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int base = x < width / 2 ? 60 : 190;
+      for (int c = 0; c < channels; c++) {
+        int i = (y * width + x) * channels + c;
+        errorBefore += std::abs(noisy[i] - base);
+        errorAfter += std::abs(denoised.data.get()[i] - base);
+      }
+    }
+  }
+  EXPECT_LT(errorAfter, errorBefore / 2);
+
+  // The AVX2 exp is a polynomial, so the paths only agree approximately;
+  // 70 columns leave a tail after the last full vector of each row
+  params.simd = false;
+  Image scalar = nonLocalMeans(noisyImg, params, 2);
+  params.simd = true;
+  int largest = 0, differing = 0;
+  for (int i = 0; i < sz; i++) {
+    int diff = std::abs(scalar.data.get()[i] - denoised.data.get()[i]);
+    largest = std::max(largest, diff);
+    differing += diff != 0;
+  }
+  EXPECT_LE(largest, 1);
+  EXPECT_LT(differing, sz / 100);
+}
+
+TEST(ConvolutionTest, WinogradMatchesDirect) {
+  Kernel custom = {
+      {0.3f, -1.2f, 0.5f}, {2.0f, 0.25f, -0.7f}, {0.1f, 0.9f, -0.4f}};
+  for (auto kernel : {kernels[Filter::HighPass3x3], custom}) {
+    for (int channels : {1, 3, 4}) {
+      for (auto size : {std::make_pair(12, 9), std::make_pair(17, 10)}) {
+        int width = size.first, height = size.second;
+        int sz = width * height * channels;
+        unsigned char *testImage = new unsigned char[sz];
+        for (int i = 0; i < sz; i++) {
+          testImage[i] = (i * 97 + i / 7) % 256;
+        }
+        Image testImg = Image(testImage, width, height, channels);
+
+        Image expected = applyKernelSeq(testImg, kernel);
+        ConvolutionOptions options;
+        EXPECT_NE(selectBackend(testImg, kernel, options),
+                  ConvolutionBackend::Winograd);
+        options.backend = ConvolutionBackend::Winograd;
+        Image actual = convolve(testImg, kernel, 2, options);
+        for (int i = 0; i < sz; i++) {
+          EXPECT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+              << "channels " << channels << " index " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(ConvolutionTest, SparseKernelFoldsTapsAndMatchesDirect) {
+  SparseKernel highPass = SparseKernel::compile(kernels[Filter::HighPass3x3]);
+  EXPECT_EQ(highPass.groups.size(), 2u);
+  EXPECT_EQ(highPass.nonZeroTaps, 9);
+
+  Kernel cross = {{0, 0, 1, 0, 0},
+                  {0, 0, 2, 0, 0},
+                  {1, 2, -12, 2, 1},
+                  {0, 0, 2, 0, 0},
+                  {0, 0, 1, 0, 0}};
+  SparseKernel crossSparse = SparseKernel::compile(cross);
+  EXPECT_EQ(crossSparse.groups.size(), 3u);
+  EXPECT_EQ(crossSparse.nonZeroTaps, 9);
+
+  Kernel sobel = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+  EXPECT_EQ(SparseKernel::compile(sobel).groups.size(), 2u);
+
+  for (auto kernel : {cross, sobel, kernels[Filter::LowPass5x5]}) {
+    int width = 23, height = 14, channels = 3;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int i = 0; i < sz; i++) {
+      testImage[i] = (i * 31 + i / 5) % 256;
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    Image expected = applyKernelSeq(testImg, kernel);
+    ConvolutionOptions options;
+    options.backend = ConvolutionBackend::Sparse;
+    Image actual = convolve(testImg, kernel, 2, options);
+    for (int i = 0; i < sz; i++) {
+      EXPECT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+          << "index " << i;
+    }
+  }
+}
+
+TEST(ConvolutionTest, LowRankDecompositionMatchesDirect) {
+  KernelDecomposition gaussian =
+      KernelDecomposition::analyze(kernels[Filter::Gaussian]);
+  EXPECT_EQ(gaussian.rankFor(1e-6f), 1);
+  EXPECT_NEAR(gaussian.singularValues[0], 0.375f, 1e-6);
+
+  // Sum of two outer products: rank 2 but not separable
+  float a[5] = {1, 2, 3, 2, 1}, b[5] = {1, -1, 0, 1, -1};
+  float c[5] = {0, 1, 1, 1, 0}, d[5] = {2, 0, 1, 0, 2};
+  Kernel kernel(5, std::vector<float>(5));
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 5; j++) {
+      kernel[i][j] = (a[i] * b[j] + c[i] * d[j]) / 20.0f;
+    }
+  }
+  KernelDecomposition decomposition = KernelDecomposition::analyze(kernel);
+  EXPECT_GT(decomposition.errors[1], 1e-2f);
+  EXPECT_LT(decomposition.errors[2], 1e-5f);
+  EXPECT_EQ(decomposition.rankFor(1e-4f), 2);
+
+  int width = 21, height = 13, channels = 4;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 53 + i / 3) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  Image expected = applyKernelSeq(testImg, kernel);
+  ConvolutionOptions options;
+  options.backend = ConvolutionBackend::LowRank;
+  Image actual = convolve(testImg, kernel, 2, options);
+  for (int i = 0; i < sz; i++) {
+    EXPECT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+        << "index " << i;
+  }
+  EXPECT_EQ(selectBackend(testImg, kernels[Filter::LowPass5x5]),
+            ConvolutionBackend::LowRank);
+}
+
+TEST(ConvolutionTest, JitKernelMatchesDirectAndIsCached) {
+  Kernel custom = {{0.1f, 0.0f, -0.3f, 0.0f, 0.05f},
+                   {0.0f, 0.2f, 0.0f, 0.4f, 0.0f},
+                   {-0.2f, 0.0f, 1.5f, 0.0f, 0.15f},
+                   {0.0f, 0.3f, 0.0f, -0.6f, 0.0f},
+                   {0.25f, 0.0f, 0.1f, 0.0f, -0.35f}};
+  for (int channels : {1, 3, 4}) {
+    int width = 29, height = 12;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int i = 0; i < sz; i++) {
+      testImage[i] = (i * 41 + i / 9) % 256;
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    Image expected = applyKernelSeq(testImg, custom);
+    ConvolutionOptions options;
+    options.backend = ConvolutionBackend::Jit;
+    Image actual = convolve(testImg, custom, 2, options);
+    for (int i = 0; i < sz; i++) {
+      EXPECT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+          << "channels " << channels << " index " << i;
+    }
+  }
+
+  auto routine = JitKernel::get(custom, 3);
+  if (routine) {
+    EXPECT_EQ(routine, JitKernel::get(custom, 3));
+    EXPECT_NE(routine, JitKernel::get(custom, 4));
+    EXPECT_EQ(routine->taps.size(), 13u);
+  }
+}
+
+TEST(ConvolutionTest, LutKernelMatchesDirect) {
+  Kernel custom = {
+      {0.3f, -1.2f, 0.5f}, {2.0f, 0.0f, -0.7f}, {0.1f, 0.9f, -0.4f}};
+  LutKernel lut = LutKernel::compile(custom);
+  EXPECT_EQ(lut.taps.size(), 8u);
+  EXPECT_EQ(lut.fractionBits, 16);
+
+  for (auto kernel : {custom, kernels[Filter::LowPass5x5]}) {
+    int width = 19, height = 11, channels = 3;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int i = 0; i < sz; i++) {
+      testImage[i] = (i * 71 + i / 4) % 256;
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    Image expected = applyKernelSeq(testImg, kernel);
+    ConvolutionOptions options;
+    options.backend = ConvolutionBackend::Lut;
+    Image actual = convolve(testImg, kernel, 2, options);
+    for (int i = 0; i < sz; i++) {
+      EXPECT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+          << "index " << i;
+    }
+  }
+}
+
+TEST(ConvolutionTest, TransposedColumnPassMatchesRows) {
+  for (int channels : {1, 3, 4}) {
+    // Odd sizes exercise the scalar edges of the 4x4 SIMD tiles
+    int width = 150, height = 71;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int i = 0; i < sz; i++) {
+      testImage[i] = (i * 37 + i / 5) % 256;
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    Image transposed = transposeImage(testImg, 2);
+    ASSERT_EQ(transposed.width, height);
+    ASSERT_EQ(transposed.height, width);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+          ASSERT_EQ(transposed.data.get()[(x * height + y) * channels + c],
+                    testImage[(y * width + x) * channels + c]);
+        }
+      }
+    }
+
+    KernelDecomposition decomposition =
+        KernelDecomposition::analyze(kernels[Filter::LowPass5x5]);
+    int rank = decomposition.rankFor(1e-4f);
+    Image rows = applyKernelLowRank(testImg, decomposition, rank, 2,
+                                    ColumnPass::Rows);
+    Image tiles = applyKernelLowRank(testImg, decomposition, rank, 2,
+                                     ColumnPass::Transposed);
+    for (int i = 0; i < sz; i++) {
+      EXPECT_NEAR(tiles.data.get()[i], rows.data.get()[i], 1) << "index " << i;
+    }
+  }
+}
+
+TEST(ConvolutionTest, IteratedMatchesRepeatedPasses) {
+  for (int channels : {3, 4}) {
+    // Taller than one strip so neighbouring strips share recomputed halos
+    int width = 37, height = 301;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int i = 0; i < sz; i++) {
+      testImage[i] = (i * 29 + i / 7) % 256;
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    for (Filter filter : {Filter::LowPass3x3, Filter::LowPass5x5}) {
+      SparseKernel kernel = SparseKernel::compile(kernels[filter]);
+      // 11 iterations: one full time block of 8 and a partial one
+      Image expected = applyKernelSparse(testImg, kernel, 1);
+      for (int i = 1; i < 11; i++) {
+        expected = applyKernelSparse(expected, kernel, 1);
+      }
+      Image actual = applyKernelIterated(testImg, kernel, 11, 2);
+      for (int i = 0; i < sz; i++) {
+        ASSERT_EQ(actual.data.get()[i], expected.data.get()[i])
+            << "index " << i;
+      }
+    }
+
+    ConvolutionOptions options;
+    options.iterations = 3;
+    Image viaEngine = convolve(testImg, kernels[Filter::LowPass3x3], 2, options);
+    Image once = applyKernelIterated(
+        testImg, SparseKernel::compile(kernels[Filter::LowPass3x3]), 3, 1);
+    EXPECT_EQ(memcmp(viaEngine.data.get(), once.data.get(), sz), 0);
+  }
+}
+
+TEST(ConvolutionTest, FlatTilesAreSkippedExactly) {
+  for (int channels : {1, 3, 4}) {
+    // Uniform background with a noisy square: only tiles away from it are
+    // flat
+    int width = 300, height = 200;
+    int sz = width * height * channels;
+    unsigned char *testImage = new unsigned char[sz];
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+          int i = (y * width + x) * channels + c;
+          bool noisy = x >= 100 && x < 160 && y >= 50 && y < 120;
+          testImage[i] = noisy ? (i * 53 + i / 3) % 256 : 180 + 20 * c;
+        }
+      }
+    }
+    Image testImg = Image(testImage, width, height, channels);
+
+    for (Filter filter : {Filter::LowPass3x3, Filter::LowPass5x5,
+                          Filter::HighPass3x3}) {
+      SparseKernel kernel = SparseKernel::compile(kernels[filter]);
+      Image expected = applyKernelSparse(testImg, kernel, 1);
+      FlatTileStats stats;
+      Image actual = applyKernelSparseSkipFlat(testImg, kernel, 2, &stats);
+      EXPECT_EQ(memcmp(actual.data.get(), expected.data.get(), sz), 0);
+      EXPECT_EQ(stats.total, 20);
+      EXPECT_GE(stats.skipped, 14);
+      EXPECT_LT(stats.skipped, stats.total);
+
+      // convolve() only skips tiles where the sparse backend runs, so the
+      // option never hides the backend Auto would pick
+      for (ConvolutionBackend backend :
+           {ConvolutionBackend::Auto, ConvolutionBackend::Sparse}) {
+        ConvolutionOptions plain;
+        plain.backend = backend;
+        ConvolutionOptions skipping = plain;
+        FlatTileStats engineStats;
+        skipping.skipFlatTiles = true;
+        skipping.flatTileStats = &engineStats;
+        Image unskipped = convolve(testImg, kernels[filter], 1, plain);
+        Image skipped = convolve(testImg, kernels[filter], 1, skipping);
+        EXPECT_EQ(memcmp(skipped.data.get(), unskipped.data.get(), sz), 0);
+        const bool sparse =
+            backend == ConvolutionBackend::Sparse ||
+            selectBackend(testImg, kernels[filter]) ==
+                ConvolutionBackend::Sparse;
+        EXPECT_EQ(engineStats.total, sparse ? 20 : 0);
+      }
+    }
+  }
+}
+
+TEST(ExecutorTest, RunsEveryTaskOnceAndBackendsAgree) {
+  std::vector<std::unique_ptr<Executor>> executors;
+  executors.push_back(makeExecutor(ExecutorKind::Sequential, 1));
+#ifdef OPENMP
+  executors.push_back(makeExecutor(ExecutorKind::OpenMp, 3));
+#else
+  EXPECT_THROW(makeExecutor(ExecutorKind::OpenMp, 3), std::runtime_error);
+#endif
+  executors.push_back(makeExecutor(ExecutorKind::WorkStealing, 3));
+#ifdef PARAFILTER_PSTL
+  executors.push_back(makeExecutor(ExecutorKind::ParallelStl, 3));
+#else
+  EXPECT_THROW(makeExecutor(ExecutorKind::ParallelStl, 3),
+               std::runtime_error);
+#endif
+
+  int width = 41, height = 23, channels = 4;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 71 + i / 11) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  Image expected = applyKernelSeq(testImg, kernels[Filter::LowPass5x5]);
+
+  for (auto &executor : executors) {
+    std::vector<std::atomic<int>> runs(1000);
+    std::atomic<bool> workerInRange{true};
+    executor->parallelFor(1000, [&](int task, int worker) {
+      runs[task]++;
+      if (worker < 0 || worker >= executor->workers()) {
+        workerInRange = false;
+      }
+    });
+    EXPECT_TRUE(workerInRange) << executor->name();
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_EQ(runs[i], 1) << executor->name() << " task " << i;
+    }
+
+    for (ConvolutionBackend backend :
+         {ConvolutionBackend::Direct, ConvolutionBackend::Sparse,
+          ConvolutionBackend::LowRank, ConvolutionBackend::Jit}) {
+      ConvolutionOptions options;
+      options.backend = backend;
+      Image actual =
+          convolve(testImg, kernels[Filter::LowPass5x5], *executor, options);
+      for (int i = 0; i < sz; i++) {
+        ASSERT_NEAR(actual.data.get()[i], expected.data.get()[i], 1)
+            << executor->name() << " " << backendName(backend) << " index "
+            << i;
+      }
+    }
+  }
+}
+
+TEST(ThreadPoolTest, RunsTasksOnceAndContextMatchesFilters) {
+  ThreadPool pool(4);
+  for (int round = 0; round < 50; round++) {
+    std::vector<std::atomic<int>> runs(round * 7 + 1);
+    std::atomic<bool> workerInRange{true};
+    pool.parallelFor(runs.size(), [&](int task, int worker) {
+      runs[task]++;
+      if (worker < 0 || worker >= pool.workers()) {
+        workerInRange = false;
+      }
+      // Nested calls run inline on this thread
+      int inner = 0;
+      pool.parallelFor(3, [&](int, int innerWorker) {
+        EXPECT_EQ(innerWorker, 0);
+        inner++;
+      });
+      EXPECT_EQ(inner, 3);
+    });
+    EXPECT_TRUE(workerInRange);
+    for (size_t i = 0; i < runs.size(); i++) {
+      ASSERT_EQ(runs[i], 1) << "round " << round << " task " << i;
+    }
+  }
+  EXPECT_THROW(pool.parallelFor(100,
+                                [](int task, int) {
+                                  if (task == 42) {
+                                    throw std::runtime_error("task failed");
+                                  }
+                                }),
+               std::runtime_error);
+
+  int width = 77, height = 45, channels = 4;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 37 + i / 13) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  ProcessingContext context(3);
+  EXPECT_EQ(context.threads(), 3);
+
+  auto expectSame = [](const Image &actual, const Image &expected) {
+    ASSERT_EQ(actual.width, expected.width);
+    ASSERT_EQ(actual.height, expected.height);
+    int n = actual.width * actual.height * actual.channels;
+    for (int i = 0; i < n; i++) {
+      ASSERT_EQ(actual.data.get()[i], expected.data.get()[i]) << "index " << i;
+    }
+  };
+  expectSame(context.convolve(testImg, kernels[Filter::LowPass5x5]),
+             convolve(testImg, kernels[Filter::LowPass5x5], 1));
+  UnsharpMaskParams params;
+  expectSame(context.unsharpMask(testImg, params),
+             unsharpMask(testImg, params, 1));
+  expectSame(context.resize(testImg, 31, 52, ResampleFilter::Lanczos3),
+             resize(testImg, 31, 52, ResampleFilter::Lanczos3, 1));
+  expectSame(context.guidedFilter(testImg, testImg, 3, 0.01f),
+             guidedFilter(testImg, testImg, 3, 0.01f, 1));
+  ImagePyramid pyramid = context.pyramid(testImg, 0);
+  pyramid.buildAll();
+  expectSame(pyramid.reconstruct(), ImagePyramid(testImg, 0, 1).reconstruct());
+}
+
+TEST(ThreadPoolTest, NthreadsOverloadsShareOneContextPerCount) {
+  ProcessingContext &shared = ProcessingContext::shared(3);
+  EXPECT_EQ(&ProcessingContext::shared(3), &shared);
+  EXPECT_EQ(shared.threads(), 3);
+  EXPECT_EQ(ProcessingContext::shared(0).threads(), 1);
+
+  // Calls reuse the same workers instead of starting new ones
+  std::mutex mutex;
+  std::set<std::thread::id> ids;
+  for (int call = 0; call < 5; call++) {
+    shared.executor().parallelFor(64, [&](int, int) {
+      std::lock_guard<std::mutex> lock(mutex);
+      ids.insert(std::this_thread::get_id());
+    });
+  }
+  EXPECT_LE(ids.size(), 3u);
+
+  // Callers on several threads take turns on the shared pool
+  int width = 61, height = 37, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 53 + i / 9) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  Image expected = applyKernelSeq(testImg, kernel);
+  std::vector<std::thread> callers;
+  std::atomic<int> mismatches{0};
+  for (int t = 0; t < 4; t++) {
+    callers.emplace_back([&] {
+      for (int round = 0; round < 5; round++) {
+        Image actual = convolve(testImg, kernel, 3);
+        for (int i = 0; i < sz; i++) {
+          if (std::abs(actual.data.get()[i] - expected.data.get()[i]) > 1) {
+            mismatches++;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread &caller : callers) {
+    caller.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+}
+
+TEST(WorkStealingTest, DequeAndExecutorRunEveryTaskOnce) {
+  // Owner pushes and takes while thieves steal: each range comes out once
+  ChaseLevDeque deque;
+  const int total = 20000;
+  std::vector<std::atomic<int>> seen(total);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (int t = 0; t < 3; t++) {
+    thieves.emplace_back([&] {
+      TaskRange range;
+      while (!done) {
+        if (deque.steal(range)) {
+          seen[range.begin]++;
+        }
+      }
+    });
+  }
+  TaskRange range;
+  for (int i = 0; i < total; i++) {
+    while (!deque.push({i, i + 1})) {
+      if (deque.take(range)) {
+        seen[range.begin]++;
+      }
+    }
+    if (i % 3 == 0 && deque.take(range)) {
+      seen[range.begin]++;
+    }
+  }
+  while (deque.take(range)) {
+    seen[range.begin]++;
+  }
+  done = true;
+  for (std::thread &thief : thieves) {
+    thief.join();
+  }
+  for (int i = 0; i < total; i++) {
+    ASSERT_EQ(seen[i], 1) << "range " << i;
+  }
+
+  // Uneven task costs: every task runs once and the stats add up
+  WorkStealingExecutor executor(4);
+  const int count = 3000;
+  std::vector<std::atomic<int>> runs(count);
+  std::atomic<long> sink{0};
+  executor.parallelFor(count, [&](int task, int worker) {
+    EXPECT_GE(worker, 0);
+    EXPECT_LT(worker, executor.workers());
+    long work = task < 100 ? 20000 : 10;
+    long value = 0;
+    for (long k = 0; k < work; k++) {
+      value += k ^ task;
+    }
+    sink += value;
+    runs[task]++;
+  });
+  long tasks = 0;
+  for (const WorkerStats &stats : executor.stats()) {
+    tasks += stats.tasks;
+    EXPECT_LE(stats.chunks, stats.tasks);
+  }
+  EXPECT_EQ(tasks, count);
+  EXPECT_GE(executor.loadImbalance(), 1.0);
+  for (int i = 0; i < count; i++) {
+    ASSERT_EQ(runs[i], 1) << "task " << i;
+  }
+  executor.resetStats();
+  EXPECT_EQ(executor.stats()[0].tasks, 0);
+
+  int width = 59, height = 37, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 53 + i / 7) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  Image expected = convolve(testImg, kernels[Filter::LowPass5x5], 1);
+  Image actual = convolve(testImg, kernels[Filter::LowPass5x5], executor);
+  for (int i = 0; i < sz; i++) {
+    ASSERT_EQ(actual.data.get()[i], expected.data.get()[i]) << "index " << i;
+  }
+}
+
+TEST(WorkStealingTest, CallAfterThrowingTaskRunsOnlyItsOwnTasks) {
+  WorkStealingExecutor executor(4);
+  EXPECT_THROW(executor.parallelFor(100000,
+                                    [](int task, int) {
+                                      if (task == 0) {
+                                        throw std::runtime_error("task failed");
+                                      }
+                                    }),
+               std::runtime_error);
+  // Ranges the aborted call left in the deques must not leak into this one
+  const int count = 10;
+  std::vector<std::atomic<int>> runs(count);
+  std::atomic<int> outside{0};
+  executor.parallelFor(count, [&](int task, int) {
+    if (task < 0 || task >= count) {
+      outside++;
+      return;
+    }
+    runs[task]++;
+  });
+  EXPECT_EQ(outside, 0);
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(runs[i], 1) << "task " << i;
+  }
+}
+
+TEST(NumaTest, TopologyPinningAndRowBandPlacement) {
+  EXPECT_EQ(parseCpuList("0-3,8,10-11"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_TRUE(parseCpuList("").empty());
+
+  NumaTopology even({{0, 1, 2, 3}, {4, 5, 6, 7}});
+  EXPECT_EQ(even.workerNodes(4), (std::vector<int>{0, 0, 1, 1}));
+  EXPECT_EQ(even.workerCpus(4), (std::vector<int>{0, 1, 4, 5}));
+  // More workers than CPUs cycle through the node's CPUs
+  EXPECT_EQ(even.workerCpus(12),
+            (std::vector<int>{0, 1, 2, 3, 0, 1, 4, 5, 6, 7, 4, 5}));
+  NumaTopology uneven({{0, 1}, {2, 3, 4, 5, 6, 7}});
+  EXPECT_EQ(uneven.workerNodes(4), (std::vector<int>{0, 1, 1, 1}));
+  EXPECT_GE(NumaTopology::system().nodes(), 1);
+  EXPECT_GE(NumaTopology::system().totalCpus(), 1);
+
+  // Row bands: worker w always runs the w-th quarter of the tasks
+  ThreadPool pool(4, true, PoolSchedule::RowBands);
+  std::vector<int> owner(40, -1);
+  pool.parallelFor(40, [&](int task, int worker) { owner[task] = worker; });
+  for (int task = 0; task < 40; task++) {
+    EXPECT_EQ(owner[task], task / 10) << "task " << task;
+  }
+
+  int width = 61, height = 33, channels = 3;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 29 + i / 5) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  for (NumaPlacement placement :
+       {NumaPlacement::FirstTouch, NumaPlacement::Interleave}) {
+    Image placed = placeRowBands(testImg, pool, placement);
+    ASSERT_EQ(placed.width, width);
+    ASSERT_EQ(placed.height, height);
+    for (int i = 0; i < sz; i++) {
+      ASSERT_EQ(placed.data.get()[i], testImage[i]) << "index " << i;
+    }
+    // Padding swaps in a regular buffer and releases the mapped one
+    placed.padReplication(2);
+    Image expected = convolve(placed, kernels[Filter::LowPass5x5], 1);
+    Image actual = convolve(placed, kernels[Filter::LowPass5x5], pool);
+    for (int i = 0; i < placed.width * placed.height * channels; i++) {
+      ASSERT_EQ(actual.data.get()[i], expected.data.get()[i]) << "index " << i;
+    }
+  }
+}
+
+TEST(ThreadPolicyTest, ScalesWithWorkAndAvoidsSmtWhenMemoryBound) {
+  // 4 cores with 2 hardware threads each
+  CpuTopology topology = CpuTopology::fromSiblingLists(
+      {"0,4", "1,5", "2,6", "3,7", "0,4", "1,5", "2,6", "3,7"});
+  EXPECT_EQ(topology.logicalCpus, 8);
+  EXPECT_EQ(topology.physicalCores, 4);
+  EXPECT_EQ(topology.threadsPerCore(), 2);
+  CpuTopology half = topology.sharedBy(2);
+  EXPECT_EQ(half.physicalCores, 2);
+  EXPECT_EQ(half.logicalCpus, 4);
+  EXPECT_EQ(topology.sharedBy(16).physicalCores, 1);
+
+  // A thumbnail stays on one thread
+  ThreadDecision small = chooseThreadCount(64 * 64 * 3, 9, topology);
+  EXPECT_EQ(small.threads, 1);
+  EXPECT_FALSE(small.smt);
+  EXPECT_NE(small.report().find("Using 1 thread"), std::string::npos);
+
+  // A large image with a light kernel uses every core but not SMT
+  ThreadDecision light = chooseThreadCount(4800L * 2400 * 3, 9, topology);
+  EXPECT_EQ(light.threads, 4);
+  EXPECT_FALSE(light.smt);
+  EXPECT_NE(light.reason.find("memory-bound"), std::string::npos);
+
+  // A heavy kernel also uses the SMT siblings
+  ThreadDecision heavy = chooseThreadCount(4800L * 2400 * 3, 49, topology);
+  EXPECT_EQ(heavy.threads, 8);
+  EXPECT_TRUE(heavy.smt);
+
+  // Threads grow with the work in between
+  ThreadDecision medium = chooseThreadCount(500L * 500 * 3, 9, topology);
+  EXPECT_GT(medium.threads, 1);
+  EXPECT_LT(medium.threads, 4);
+
+  EXPECT_EQ(kernelOpsPerSample(kernels[Filter::LowPass3x3]), 9);
+  EXPECT_GE(CpuTopology::system().logicalCpus,
+            CpuTopology::system().physicalCores);
+}
+
+TEST(BatchProcessorTest, NestsFilterTasksAndAdmitsWithinBudget) {
+  // Mixed sizes: one large image among thumbnails
+  std::vector<Image> inputs;
+  for (int i = 0; i < 8; i++) {
+    int width = i == 2 ? 240 : 24 + i, height = i == 2 ? 160 : 20, channels = 3;
+    int sz = width * height * channels;
+    unsigned char *data = new unsigned char[sz];
+    for (int j = 0; j < sz; j++) {
+      data[j] = (j * 37 + j / 13 + i * 11) % 256;
+    }
+    inputs.emplace_back(data, width, height, channels);
+  }
+  auto copyOf = [](const Image &img) {
+    size_t sz = static_cast<size_t>(img.width) * img.height * img.channels;
+    unsigned char *data = new unsigned char[sz];
+    memcpy(data, img.data.get(), sz);
+    return Image(data, img.width, img.height, img.channels);
+  };
+  std::vector<BatchItem> items;
+  for (const Image &img : inputs) {
+    BatchItem item;
+    item.bytes = static_cast<size_t>(img.width) * img.height * img.channels;
+    item.load = [&] { return copyOf(img); };
+    items.push_back(item);
+  }
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  auto filter = [&](Image &img, Executor &executor) {
+    img.padReplication(kernel.size() / 2);
+    return convolve(img, kernel, executor);
+  };
+
+  BatchProcessor batch(4, 1 << 30);
+  EXPECT_EQ(batch.workers(), 4);
+  std::vector<Image> results(items.size());
+  std::vector<std::atomic<int>> sunk(items.size());
+  batch.process(items, filter, [&](size_t index, Image &result) {
+    sunk[index]++;
+    results[index] = std::move(result);
+  });
+  EXPECT_EQ(batch.stats().images, 8);
+  for (size_t i = 0; i < items.size(); i++) {
+    ASSERT_EQ(sunk[i], 1) << "image " << i;
+    Image padded = copyOf(inputs[i]);
+    padded.padReplication(kernel.size() / 2);
+    Image expected = convolve(padded, kernel, 1);
+    ASSERT_EQ(results[i].width, expected.width);
+    ASSERT_EQ(results[i].height, expected.height);
+    size_t n = static_cast<size_t>(expected.width) * expected.height *
+               expected.channels;
+    EXPECT_EQ(memcmp(results[i].data.get(), expected.data.get(), n), 0)
+        << "image " << i;
+  }
+
+  // With room for all of them, two images are filtered at the same time
+  std::atomic<int> filtering{0};
+  std::atomic<int> mostFiltering{0};
+  auto overlapping = [&](Image &img, Executor &) {
+    int now = ++filtering;
+    int most = mostFiltering;
+    while (now > most && !mostFiltering.compare_exchange_weak(most, now)) {
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (mostFiltering < 2 &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+      std::this_thread::yield();
+    }
+    filtering--;
+    return copyOf(img);
+  };
+  batch.process(items, overlapping, [](size_t, Image &) {});
+  EXPECT_GE(mostFiltering, 2);
+  EXPECT_GE(batch.stats().peakInFlight, 2);
+
+  // A budget for one large image admits them one at a time, and an image
+  // over budget still runs alone
+  const size_t oneLarge =
+      static_cast<size_t>(items[2].bytes * BatchProcessor::FOOTPRINT_FACTOR);
+  BatchProcessor tight(4, oneLarge);
+  std::atomic<int> done{0};
+  tight.process({items[2], items[2], items[2]}, filter,
+                [&](size_t, Image &) { done++; });
+  EXPECT_EQ(done, 3);
+  EXPECT_EQ(tight.stats().peakInFlight, 1);
+  EXPECT_LE(tight.stats().peakBytes, oneLarge);
+  EXPECT_LE(tight.stats().waits, 2);
+  BatchProcessor tiny(2, 1);
+  tiny.process(items, filter, [&](size_t, Image &) { done++; });
+  EXPECT_EQ(done, 11);
+  EXPECT_EQ(tiny.stats().peakInFlight, 1);
+
+  // Tasks of a call from outside run once each; failures are rethrown
+  std::vector<std::atomic<int>> runs(1000);
+  batch.parallelFor(runs.size(), [&](int task, int worker) {
+    ASSERT_GE(worker, 0);
+    ASSERT_LT(worker, batch.workers());
+    runs[task]++;
+  });
+  for (size_t i = 0; i < runs.size(); i++) {
+    ASSERT_EQ(runs[i], 1) << "task " << i;
+  }
+  items[5].load = []() -> Image { throw std::runtime_error("corrupt file"); };
+  EXPECT_THROW(batch.process(items, filter, [](size_t, Image &) {}),
+               std::runtime_error);
+  EXPECT_THROW(fileItem("./missing.png"), std::runtime_error);
+}
+
+TEST(PipelineTest, QueueHandsOffOnceAndStagesMatchSequential) {
+  BoundedQueue<int> queue(3);
+  EXPECT_EQ(queue.capacity(), 4u);
+  for (int i = 0; i < 4; i++) {
+    int item = i;
+    EXPECT_TRUE(queue.tryPush(item));
+  }
+  int item = 4;
+  EXPECT_FALSE(queue.tryPush(item));
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.tryPop(item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(queue.tryPop(item));
+
+  // Two producers and two consumers through a small queue
+  BoundedQueue<int> shared(8);
+  const int perProducer = 20000;
+  std::vector<std::atomic<int>> seen(2 * perProducer);
+  std::atomic<int> producersLeft{2};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < 2; p++) {
+    threads.emplace_back([&, p] {
+      for (int i = 0; i < perProducer; i++) {
+        int value = p * perProducer + i;
+        shared.push(value);
+      }
+      if (--producersLeft == 0) {
+        shared.close();
+      }
+    });
+  }
+  for (int c = 0; c < 2; c++) {
+    threads.emplace_back([&] {
+      int value;
+      while (shared.pop(value)) {
+        seen[value]++;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < seen.size(); i++) {
+    ASSERT_EQ(seen[i], 1) << "item " << i;
+  }
+  int late = 1;
+  EXPECT_FALSE(shared.push(late));
+
+  std::vector<Image> inputs;
+  for (int i = 0; i < 12; i++) {
+    int width = 40 + 7 * i, height = 30 + i, channels = 3 + i % 2;
+    int sz = width * height * channels;
+    unsigned char *data = new unsigned char[sz];
+    for (int j = 0; j < sz; j++) {
+      data[j] = (j * 31 + j / 7 + i * 5) % 256;
+    }
+    inputs.emplace_back(data, width, height, channels);
+  }
+  auto copyOf = [](const Image &img) {
+    size_t sz = static_cast<size_t>(img.width) * img.height * img.channels;
+    unsigned char *data = new unsigned char[sz];
+    memcpy(data, img.data.get(), sz);
+    return Image(data, img.width, img.height, img.channels);
+  };
+  std::vector<BatchItem> items;
+  for (const Image &img : inputs) {
+    BatchItem batchItem;
+    batchItem.load = [&] { return copyOf(img); };
+    items.push_back(batchItem);
+  }
+  UnsharpMaskParams params;
+  auto filter = [&](Image &img, Executor &executor) {
+    return unsharpMask(img, params, executor);
+  };
+  PipelineOptions options;
+  options.decoders = 2;
+  options.filterWorkers = 2;
+  options.filterThreads = 2;
+  options.encoders = 2;
+  options.queueCapacity = 2;
+  std::vector<Image> results(items.size());
+  std::vector<std::atomic<int>> sunk(items.size());
+  PipelineStats stats =
+      runPipeline(items, filter, [&](size_t index, Image &result) {
+        sunk[index]++;
+        results[index] = std::move(result);
+      }, options);
+  EXPECT_EQ(stats.images, 12);
+  EXPECT_GT(stats.filterSeconds, 0);
+  for (size_t i = 0; i < items.size(); i++) {
+    ASSERT_EQ(sunk[i], 1) << "image " << i;
+    Image expected = unsharpMask(inputs[i], params, 1);
+    size_t n = static_cast<size_t>(expected.width) * expected.height *
+               expected.channels;
+    ASSERT_EQ(results[i].width, expected.width);
+    EXPECT_EQ(memcmp(results[i].data.get(), expected.data.get(), n), 0)
+        << "image " << i;
+  }
+
+  // A failing encoder stops the pipeline instead of blocking it
+  EXPECT_THROW(runPipeline(items, filter,
+                           [](size_t index, Image &) {
+                             if (index == 3) {
+                               throw std::runtime_error("disk full");
+                             }
+                           },
+                           options),
+               std::runtime_error);
+}
+
+TEST(AsyncFilterTest, FuturesMatchFiltersAndStopWhenAbandoned) {
+  int width = 97, height = 61, channels = 4;
+  int sz = width * height * channels;
+  unsigned char *testImage = new unsigned char[sz];
+  for (int i = 0; i < sz; i++) {
+    testImage[i] = (i * 37 + i / 13) % 256;
+  }
+  Image testImg = Image(testImage, width, height, channels);
+  auto copyOf = [](const Image &img) {
+    size_t sz = static_cast<size_t>(img.width) * img.height * img.channels;
+    unsigned char *data = new unsigned char[sz];
+    memcpy(data, img.data.get(), sz);
+    return Image(data, img.width, img.height, img.channels);
+  };
+  auto expectSame = [](const Image &actual, const Image &expected) {
+    ASSERT_EQ(actual.width, expected.width);
+    ASSERT_EQ(actual.height, expected.height);
+    size_t n = static_cast<size_t>(actual.width) * actual.height *
+               actual.channels;
+    EXPECT_EQ(memcmp(actual.data.get(), expected.data.get(), n), 0);
+  };
+
+  AsyncFilter filter(3);
+  EXPECT_EQ(filter.threads(), 3);
+  Kernel kernel = kernels[Filter::LowPass5x5];
+  UnsharpMaskParams params;
+  std::future<Image> blurred = filter.applyKernel(copyOf(testImg), kernel);
+  std::future<Image> sharpened = filter.unsharpMask(copyOf(testImg), params);
+  expectSame(blurred.get(), convolve(testImg, kernel, 1));
+  expectSame(sharpened.get(), unsharpMask(testImg, params, 1));
+
+  // A long request stops soon after its token is cancelled, and one queued
+  // behind it with the same token never starts
+  const int tiles = 2000;
+  std::atomic<int> started{0};
+  auto slowWork = [&](Executor &executor) {
+    executor.parallelFor(tiles, [&](int, int) {
+      started++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    return Image();
+  };
+  CancellationToken token;
+  std::future<Image> slow = filter.submit(slowWork, token);
+  std::atomic<bool> queuedRan{false};
+  std::future<Image> queued = filter.submit(
+      [&](Executor &) {
+        queuedRan = true;
+        return Image();
+      },
+      token);
+  while (started == 0) {
+    std::this_thread::yield();
+  }
+  auto cancelledAt = std::chrono::steady_clock::now();
+  token.cancel();
+  try {
+    slow.get();
+    FAIL() << "cancelled request finished";
+  } catch (const FilterCancelled &e) {
+    EXPECT_EQ(e.reason(), FilterCancelled::Reason::Cancelled);
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - cancelledAt,
+            std::chrono::milliseconds(500));
+  EXPECT_LT(started, tiles);
+  EXPECT_THROW(queued.get(), FilterCancelled);
+  EXPECT_FALSE(queuedRan);
+
+  // Deadlines stop running requests and reject expired ones
+  started = 0;
+  std::future<Image> late = filter.submit(
+      slowWork, CancellationToken(),
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(20));
+  try {
+    late.get();
+    FAIL() << "request outlived its deadline";
+  } catch (const FilterCancelled &e) {
+    EXPECT_EQ(e.reason(), FilterCancelled::Reason::DeadlineExceeded);
+  }
+  EXPECT_LT(started, tiles);
+  EXPECT_THROW(filter
+                   .applyKernel(copyOf(testImg), kernel, CancellationToken(),
+                                std::chrono::steady_clock::now())
+                   .get(),
+               FilterCancelled);
+
+  // Other failures reach the future too
+  EXPECT_THROW(filter
+                   .submit([](Executor &) -> Image {
+                     throw std::runtime_error("bad input");
+                   })
+                   .get(),
+               std::runtime_error);
+}
+
+TEST(AsyncFilterTest, CancellationStopsEveryExecutor) {
+  std::vector<std::unique_ptr<Executor>> executors;
+  executors.push_back(makeExecutor(ExecutorKind::Sequential, 1));
+#ifdef OPENMP
+  executors.push_back(makeExecutor(ExecutorKind::OpenMp, 4));
+#endif
+  executors.push_back(makeExecutor(ExecutorKind::WorkStealing, 4));
+#ifdef PARAFILTER_PSTL
+  executors.push_back(makeExecutor(ExecutorKind::ParallelStl, 4));
+#endif
+  executors.push_back(std::make_unique<ThreadPool>(4));
+
+  const int tasks = 2000, cancelAfter = 10;
+  for (auto &inner : executors) {
+    CancellationToken token;
+    CancellableExecutor executor(*inner, token);
+    std::atomic<int> started{0};
+    try {
+      executor.parallelFor(tasks, [&](int, int) {
+        if (++started == cancelAfter) {
+          token.cancel();
+        }
+      });
+      FAIL() << inner->name() << " finished a cancelled call";
+    } catch (const FilterCancelled &e) {
+      EXPECT_EQ(e.reason(), FilterCancelled::Reason::Cancelled);
+    }
+    // Each worker may have passed its check before the token fired
+    EXPECT_LE(started, cancelAfter + inner->workers()) << inner->name();
+
+    // The executor is still usable afterwards
+    std::atomic<int> runs{0};
+    inner->parallelFor(100, [&](int, int) { runs++; });
+    EXPECT_EQ(runs, 100) << inner->name();
+  }
+}
+
+TEST(DistributedTest, PartitionsCoverEveryRowOnceAndGridFollowsShape) {
+  const int halo = 2;
+  for (int ranks : {1, 3, 7, 16}) {
+    for (int interior : {ranks * halo, 103, 2160}) {
+      if (interior < ranks * halo) {
+        continue;
+      }
+      const int height = interior + 2 * halo;
+      StripePartition partition = partitionStripes(height, halo, ranks);
+      ASSERT_EQ(partition.rows.size(), static_cast<size_t>(ranks));
+      int next = 0, smallest = interior, largest = 0;
+      for (int rank = 0; rank < ranks; rank++) {
+        EXPECT_EQ(partition.first[rank], next) << ranks << " ranks";
+        next += partition.rows[rank];
+        const int rows = partition.interiorRows(rank, halo);
+        EXPECT_GE(rows, halo);
+        smallest = std::min(smallest, rows);
+        largest = std::max(largest, rows);
+      }
+      EXPECT_EQ(next, height) << ranks << " ranks, " << interior << " rows";
+      EXPECT_LE(largest - smallest, 1);
+      // Remainder rows go to the first stripes
+      EXPECT_EQ(partition.interiorRows(0, halo), largest);
+      EXPECT_EQ(partition.first[0], 0);
+      EXPECT_EQ(partition.rows[0], partition.interiorRows(0, halo) + halo +
+                                       (ranks == 1 ? halo : 0));
+    }
+  }
+  // Stripes thinner than the halo would need rows from beyond a neighbour
+  EXPECT_THROW(partitionStripes(15 + 2 * halo, halo, 8), std::runtime_error);
+  EXPECT_NO_THROW(partitionStripes(16 + 2 * halo, halo, 8));
+
+  // Blocks once stripes get long and thin, shaped after the image
+  ProcessGrid single = chooseProcessGrid(3842, 2162, 1, 1);
+  EXPECT_EQ(single.rows * single.cols, 1);
+  // Two block rows leave each block a single vertical neighbour
+  ProcessGrid blocks = chooseProcessGrid(3842, 2162, 1, 16);
+  EXPECT_EQ(blocks.rows, 2);
+  EXPECT_EQ(blocks.cols, 8);
+  ProcessGrid square = chooseProcessGrid(4002, 4002, 1, 36);
+  EXPECT_EQ(square.rows, 6);
+  EXPECT_EQ(square.cols, 6);
+  ProcessGrid wide = chooseProcessGrid(3842, 2162, 1, 2);
+  EXPECT_EQ(wide.rows, 1);
+  EXPECT_EQ(wide.cols, 2);
+  ProcessGrid tall = chooseProcessGrid(130, 20002, 1, 16);
+  EXPECT_EQ(tall.rows, 16);
+  EXPECT_EQ(tall.cols, 1);
+  ProcessGrid prime = chooseProcessGrid(1002, 1002, 1, 7);
+  EXPECT_EQ(prime.rows, 7);
+  EXPECT_EQ(prime.cols, 1);
+  // Too narrow for columns: stripes even though blocks would be cheaper
+  ProcessGrid narrow = chooseProcessGrid(7, 4002, 2, 4);
+  EXPECT_EQ(narrow.cols, 1);
+  EXPECT_THROW(chooseProcessGrid(7, 7, 2, 4), std::runtime_error);
+}
+
+TEST(DistributedTest, OverlapPlanCoversBlockOnceAndInteriorReadsNoHalo) {
+  for (int halo : {1, 2}) {
+    for (int mask = 0; mask < 16; mask++) {
+      const bool up = mask & 1, down = mask & 2, left = mask & 4,
+                 right = mask & 8;
+      // Blocks as thin as partitionStripes() allows, and larger ones
+      for (int rows : {halo, 2 * halo + 1, 37}) {
+        const int cols = rows + 3;
+        const OverlapPlan plan =
+            planOverlap(rows, cols, halo, up, down, left, right);
+        std::vector<int> covered((rows + 2 * halo) * (cols + 2 * halo), 0);
+        auto cover = [&](BlockRect rect) {
+          for (int y = rect.y0; y < rect.y1; y++) {
+            for (int x = rect.x0; x < rect.x1; x++) {
+              covered[y * (cols + 2 * halo) + x]++;
+            }
+          }
+        };
+        // The interior reads no pixel a neighbour sends
+        const BlockRect in = plan.interior;
+        if (in.y0 < in.y1 && in.x0 < in.x1) {
+          EXPECT_GE(in.y0 - halo, up ? halo : 0);
+          EXPECT_LE(in.y1 + halo, halo + rows + (down ? 0 : halo));
+          EXPECT_GE(in.x0 - halo, left ? halo : 0);
+          EXPECT_LE(in.x1 + halo, halo + cols + (right ? 0 : halo));
+          cover(in);
+        }
+        // Row edges read no halo column
+        for (BlockRect rect : plan.rowEdges) {
+          EXPECT_GE(rect.x0 - halo, left ? halo : 0);
+          EXPECT_LE(rect.x1 + halo, halo + cols + (right ? 0 : halo));
+          cover(rect);
+        }
+        for (BlockRect rect : plan.columnEdges) {
+          cover(rect);
+        }
+        for (int y = 0; y < rows + 2 * halo; y++) {
+          for (int x = 0; x < cols + 2 * halo; x++) {
+            const bool owned = y >= halo && y < halo + rows && x >= halo &&
+                               x < halo + cols;
+            ASSERT_EQ(covered[y * (cols + 2 * halo) + x], owned ? 1 : 0)
+                << "halo " << halo << ", sides " << mask << ", " << rows
+                << " rows, pixel " << x << "," << y;
+          }
+        }
+        // Stripes have no column halos to wait for
+        if (!left && !right) {
+          EXPECT_TRUE(plan.columnEdges.empty());
+        }
+      }
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();